@@ -0,0 +1,421 @@
+//
+//  code.c
+//  filagree
+//
+//  decodes bytecode into an array of instructions, so that operands are
+//  parsed once rather than on every dispatch
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "code.h"
+#include "serial.h"
+#include "util.h"
+
+#define ERROR_JUMP "jump out of bounds"
+#define ERROR_SLOT "bad variable slot"
+
+static struct code *code_alloc(void) {
+    struct code *code = (struct code*)malloc(sizeof(struct code));
+    assert_message(NULL != code, ERROR_NULL);
+    code->instructions = NULL;
+    code->length = 0;
+    code->refs = 1;
+    code->slots = 0;
+    code->names = NULL;
+    return code;
+}
+
+// note the name of a local variable slot, so the frame can be sized to fit
+static void code_local(struct code *code, int32_t slot, struct byte_array *name) {
+    if (slot < 0)
+        return;
+    if (slot >= code->slots) {
+        code->names = (struct byte_array**)realloc(code->names, (slot + 1) * sizeof(struct byte_array*));
+        null_check(code->names);
+        memset(code->names + code->slots, 0, (slot + 1 - code->slots) * sizeof(struct byte_array*));
+        code->slots = slot + 1;
+    }
+    code->names[slot] = name;
+}
+
+// an intern table's entry: the one item like it, and how many instructions use it
+struct intern {
+    void *item;
+    uint32_t uses;
+};
+
+// each VM's identifiers and literals, one of each, shared by its code; the lock is for all VMs'
+// tables, as code is decoded and freed by whichever thread has it
+static pthread_mutex_t code_strings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool code_strings_equal(const void *a, const void *b, void *context) {
+    return byte_array_equals((const struct byte_array*)a, (const struct byte_array*)b);
+}
+
+static int32_t code_strings_hash(const void *key, void *context) {
+    return byte_array_hash((const struct byte_array*)key);
+}
+
+static void *code_strings_key(const void *key, void *context) {
+    return (void*)key;
+}
+
+// the entry for item in table, with one more use, or NULL if there's none
+static struct intern *intern_use(struct dic *table, const void *item) {
+    struct intern *in = (struct intern*)dic_get(table, item);
+    if (NULL != in)
+        in->uses++;
+    return in;
+}
+
+static struct intern *intern_new(struct dic *table, void *item) {
+    struct intern *in = (struct intern*)malloc(sizeof(struct intern));
+    null_check(in);
+    in->item = item;
+    in->uses = 1;
+    dic_insert(table, item, in);
+    return in;
+}
+
+// one use less of item, which leaves the table with its last; true if it did
+static bool intern_release(struct dic *table, const void *item) {
+    struct intern *in = (struct intern*)dic_get(table, item);
+    if (--in->uses)
+        return false;
+    dic_remove(table, item);
+    free(in);
+    return true;
+}
+
+// decode a string, and return a reference to the interned one like it
+static struct byte_array *decode_string(struct context *context, struct byte_array *bytes) {
+    struct context_shared *s = context->singleton;
+    struct byte_array *str = serial_decode_string(bytes);
+    pthread_mutex_lock(&code_strings_lock);
+    if (NULL == s->strings)
+        s->strings = dic_new_ex(NULL, &code_strings_equal, &code_strings_hash, &code_strings_key, NULL);
+
+    struct intern *in = intern_use(s->strings, str);
+    if (NULL == in) {
+        in = intern_new(s->strings, str); // whose reference is the table's
+    } else {
+        byte_array_del(str);
+    }
+    str = byte_array_share((struct byte_array*)in->item);
+    pthread_mutex_unlock(&code_strings_lock);
+    return str;
+}
+
+// drops a use of the interned str and, once no code uses it, the table's reference; holders
+// of it, e.g. variable names, keep theirs
+static void release_string_locked(struct context_shared *s, struct byte_array *str, bool and_reference) {
+    if (intern_release(s->strings, str))
+        byte_array_del(str);
+    if (and_reference)
+        byte_array_del(str);
+}
+
+static void release_string(struct context *context, struct byte_array *str) {
+    pthread_mutex_lock(&code_strings_lock);
+    release_string_locked(context->singleton, str, true);
+    pthread_mutex_unlock(&code_strings_lock);
+}
+
+// literal strings and floats as immortal variables, one of each, shared by a VM's code
+static bool code_constants_equal(const void *a, const void *b, void *context) {
+    const struct variable *u = (const struct variable*)a, *v = (const struct variable*)b;
+    if (u->type != v->type)
+        return false;
+    if (VAR_STR == u->type)
+        return u->str == v->str; // interned
+    return !memcmp(&u->floater, &v->floater, sizeof(float)); // so -0.0 isn't 0.0
+}
+
+static int32_t code_constants_hash(const void *key, void *context) {
+    const struct variable *v = (const struct variable*)key;
+    if (VAR_STR == v->type)
+        return byte_array_hash(v->str);
+    int32_t bits;
+    memcpy(&bits, &v->floater, sizeof(float));
+    return bits;
+}
+
+// the constant like literal, which is on the stack; a string literal's use of its interned
+// string goes to the constant
+static struct variable *decode_constant(struct context *context, const struct variable *literal) {
+    struct context_shared *s = context->singleton;
+    pthread_mutex_lock(&code_strings_lock);
+    if (NULL == s->constants)
+        s->constants = dic_new_ex(NULL, &code_constants_equal, &code_constants_hash, &code_strings_key, NULL);
+
+    struct intern *in = intern_use(s->constants, literal);
+    if (NULL != in) {
+        if (VAR_STR == literal->type) // the constant has its own
+            release_string_locked(s, literal->str, true);
+    } else {
+        struct variable *constant = variable_new_constant(literal->type);
+        if (VAR_STR == literal->type)
+            constant->str = literal->str;
+        else
+            constant->floater = literal->floater;
+        in = intern_new(s->constants, constant);
+    }
+    pthread_mutex_unlock(&code_strings_lock);
+    return (struct variable*)in->item;
+}
+
+// once no code uses a constant, it's left to the collector, as variables may still refer to it
+static void release_constant(struct context *context, struct variable *constant) {
+    struct context_shared *s = context->singleton;
+    pthread_mutex_lock(&code_strings_lock);
+    if (intern_release(s->constants, constant)) {
+        if (VAR_STR == constant->type) // whose reference the constant keeps, until it's collected
+            release_string_locked(s, constant->str, false);
+        variable_release_constant(context, constant);
+    }
+    pthread_mutex_unlock(&code_strings_lock);
+}
+
+// frees what's left in a VM's tables, once its variables are gone
+void code_intern_del(struct context *context) {
+    struct context_shared *s = context->singleton;
+    struct intern *in;
+    if (NULL != s->constants) {
+        for (uint32_t i=0; dic_next(s->constants, &i, NULL, (void**)&in);) {
+            variable_del(context, (struct variable*)in->item);
+            free(in);
+        }
+        dic_del(s->constants);
+        s->constants = NULL;
+    }
+    if (NULL != s->strings) {
+        for (uint32_t i=0; dic_next(s->strings, &i, NULL, (void**)&in);) {
+            byte_array_del((struct byte_array*)in->item);
+            free(in);
+        }
+        dic_del(s->strings);
+        s->strings = NULL;
+    }
+}
+
+// decode a nested block, which is serialized as a string; NULL if empty
+static struct code *decode_block(struct context *context, struct code *code, struct byte_array *bytes) {
+    struct byte_array *block = serial_decode_string(bytes);
+    struct code *nested = block->length ? code_new(context, block) : NULL;
+    byte_array_del(block);
+    if (NULL != nested) // nested blocks run in the same frame
+        for (int32_t i=0; i<nested->slots; i++)
+            if (NULL != nested->names[i])
+                code_local(code, i, nested->names[i]);
+    return nested;
+}
+
+// empty blocks still get a code, for running
+static struct code *decode_block_nonnull(struct context *context, struct code *code, struct byte_array *bytes) {
+    struct code *nested = decode_block(context, code, bytes);
+    return nested ? nested : code_alloc();
+}
+
+static void decode_operands(struct context *context, struct code *code, struct byte_array *bytes,
+                            struct instruction *inst) {
+    switch (inst->op) {
+        case VM_INT:
+        case VM_BUL:
+        case VM_SRC:
+        case VM_LST:
+        case VM_CAL:
+        case VM_MET:
+        case VM_RET:
+        case VM_LIN:
+            inst->number = serial_decode_int(bytes);
+            break;
+        case VM_FLT: {
+            struct variable literal = {.type = VAR_FLT, .floater = serial_decode_float(bytes)};
+            inst->constant = decode_constant(context, &literal);
+        } break;
+        case VM_STR: {
+            struct variable literal = {.type = VAR_STR, .str = decode_string(context, bytes)};
+            inst->constant = decode_constant(context, &literal);
+        } break;
+        case VM_FIL:
+            inst->string = decode_string(context, bytes);
+            break;
+        case VM_VAR:
+        case VM_SET:
+        case VM_STX:
+            inst->number = -1; // named, not in a slot
+            inst->string = decode_string(context, bytes);
+            break;
+        case VM_VRL:
+        case VM_STL:
+        case VM_SXL:
+            inst->number = serial_decode_int(bytes);
+            inst->string = decode_string(context, bytes);
+            assert_message(inst->number >= 0, ERROR_SLOT);
+            code_local(code, inst->number, inst->string);
+            break;
+        case VM_FNC: {
+            int32_t num_closures = serial_decode_int(bytes);
+            inst->fnc.closures = array_new_size(num_closures);
+            inst->fnc.slots = (int32_t*)malloc((num_closures + 1) * sizeof(int32_t));
+            null_check(inst->fnc.slots);
+            for (int32_t i=0; i<num_closures; i++) {
+                struct byte_array *name = decode_string(context, bytes);
+                array_add(inst->fnc.closures, name);
+                inst->fnc.slots[i] = serial_decode_int(bytes);
+                code_local(code, inst->fnc.slots[i], name);
+            }
+            inst->fnc.body = serial_decode_string(bytes);
+            inst->fnc.code = code_new(context, inst->fnc.body);
+        } break;
+        case VM_ITR:
+        case VM_COM:
+            inst->number = serial_decode_int(bytes); // two iterator variables?
+            inst->itr.who = decode_string(context, bytes);
+            inst->itr.slot = serial_decode_int(bytes);
+            code_local(code, inst->itr.slot, inst->itr.who);
+            inst->itr.who2 = NULL;
+            inst->itr.slot2 = -1;
+            if (inst->number) {
+                inst->itr.who2 = decode_string(context, bytes);
+                inst->itr.slot2 = serial_decode_int(bytes);
+                code_local(code, inst->itr.slot2, inst->itr.who2);
+            }
+            inst->itr.where = decode_block(context, code, bytes);
+            inst->itr.how = decode_block_nonnull(context, code, bytes);
+            break;
+        case VM_TRY:
+            inst->trycatch.trial = decode_block_nonnull(context, code, bytes);
+            inst->trycatch.name = decode_string(context, bytes);
+            inst->trycatch.slot = serial_decode_int(bytes);
+            code_local(code, inst->trycatch.slot, inst->trycatch.name);
+            inst->trycatch.catcher = decode_block_nonnull(context, code, bytes);
+            break;
+        default:
+            break;
+    }
+}
+
+struct code *code_new(struct context *context, const struct byte_array *program) {
+    null_check(program);
+    struct byte_array bytes = *program; // cursor, so the program itself is untouched
+    bytes.current = bytes.data;
+    uint32_t size = program->length;
+
+    struct code *code = code_alloc();
+    code->instructions = (struct instruction*)malloc((size + 1) * sizeof(struct instruction));
+
+    // instruction index at each byte offset, for resolving jumps
+    int32_t *at = (int32_t*)malloc((size + 1) * sizeof(int32_t));
+    null_check(code->instructions);
+    null_check(at);
+    for (uint32_t i=0; i<=size; i++)
+        at[i] = -1;
+
+    while (bytes.current < bytes.data + size) {
+        int32_t start = (int32_t)(bytes.current - bytes.data);
+        at[start] = code->length;
+        struct instruction *inst = &code->instructions[code->length++];
+        memset(inst, 0, sizeof(struct instruction));
+        inst->op = (enum Opcode)*bytes.current++;
+        assert_message(inst->op < VM_LAST, ERROR_OPCODE);
+
+        switch (inst->op) {
+            case VM_JMP: { // backward jumps are relative to the opcode, forward to the next instruction
+                int32_t offset = serial_decode_int(&bytes);
+                inst->number = offset < 0 ? start + offset : (int32_t)(bytes.current - bytes.data) + offset;
+            } break;
+            case VM_IFF:
+            case VM_AND:
+            case VM_ORR: {
+                int32_t offset = serial_decode_int(&bytes);
+                inst->number = (int32_t)(bytes.current - bytes.data) + offset;
+            } break;
+            default:
+                decode_operands(context, code, &bytes, inst);
+                break;
+        }
+    }
+    at[size] = code->length;
+
+    // byte offsets to instruction indices
+    for (uint32_t i=0; i<code->length; i++) {
+        struct instruction *inst = &code->instructions[i];
+        switch (inst->op) {
+            case VM_JMP:
+            case VM_IFF:
+            case VM_AND:
+            case VM_ORR:
+                assert_message(inst->number >= 0 && inst->number <= size && at[inst->number] >= 0, ERROR_JUMP);
+                inst->number = at[inst->number];
+                break;
+            default:
+                break;
+        }
+    }
+
+    free(at);
+    code->instructions = (struct instruction*)realloc(code->instructions,
+                                                      (code->length + 1) * sizeof(struct instruction));
+    return code;
+}
+
+struct code *code_retain(struct code *code) {
+    if (NULL != code)
+        code->refs++;
+    return code;
+}
+
+void code_del(struct context *context, struct code *code) {
+    if ((NULL == code) || --code->refs)
+        return;
+
+    for (uint32_t i=0; i<code->length; i++) {
+        struct instruction *inst = &code->instructions[i];
+        switch (inst->op) {
+            case VM_STR:
+            case VM_FLT:
+                release_constant(context, inst->constant);
+                break;
+            case VM_VAR:
+            case VM_SET:
+            case VM_STX:
+            case VM_FIL:
+            case VM_VRL:
+            case VM_STL:
+            case VM_SXL:
+                release_string(context, inst->string);
+                break;
+            case VM_FNC:
+                for (uint32_t j=0; j<inst->fnc.closures->length; j++)
+                    release_string(context, (struct byte_array*)array_get(inst->fnc.closures, j));
+                array_del(inst->fnc.closures);
+                free(inst->fnc.slots);
+                byte_array_del(inst->fnc.body);
+                code_del(context, inst->fnc.code);
+                break;
+            case VM_ITR:
+            case VM_COM:
+                release_string(context, inst->itr.who);
+                if (NULL != inst->itr.who2)
+                    release_string(context, inst->itr.who2);
+                code_del(context, inst->itr.where);
+                code_del(context, inst->itr.how);
+                break;
+            case VM_TRY:
+                code_del(context, inst->trycatch.trial);
+                release_string(context, inst->trycatch.name);
+                code_del(context, inst->trycatch.catcher);
+                break;
+            default:
+                break;
+        }
+    }
+
+    free(code->instructions);
+    free(code->names);
+    free(code);
+}
@@ -0,0 +1,61 @@
+//
+//  code.h
+//  filagree
+//
+//  bytecode decoded into fixed-width instructions, once, before it runs
+//
+
+#ifndef CODE_H
+#define CODE_H
+
+#include "struct.h"
+#include "vm.h"
+
+struct instruction {
+    enum Opcode op;
+    int32_t number;                         // integer operand, item count, absolute jump target,
+                                            // or local variable slot (-1 for named variables)
+    union {
+        struct variable *constant;          // VM_STR, VM_FLT: immortal, shared by the VM's code
+        struct byte_array *string;          // VM_VAR, VM_SET, VM_STX, VM_FIL,
+                                            // and the name of VM_VRL, VM_STL, VM_SXL
+        struct {                            // VM_FNC
+            struct array *closures;         // names of closed-over variables
+            int32_t *slots;                 // their slots in the enclosing function, or -1
+            struct byte_array *body;        // function bytecode
+            struct code *code;              // and decoded, shared by every closure made from it
+        } fnc;
+        struct {                            // VM_ITR, VM_COM
+            struct byte_array *who, *who2;  // iterator variable names
+            int32_t slot, slot2;            // and their slots, or -1
+            struct code *where, *how;       // filter (or NULL) and loop body
+        } itr;
+        struct {                            // VM_TRY
+            struct code *trial, *catcher;
+            struct byte_array *name;        // name of caught error variable
+            int32_t slot;                   // and its slot, or -1
+        } trycatch;
+        struct {                            // VM_GET, VM_MET: inline cache of a literal index
+            const struct variable *key;     // the literal last looked up here
+            uint32_t freed;                 // the VM's constants_freed then, lest key's address be reused
+            bool other;                     // which isn't the name of a built-in method
+            uint32_t entry;                 // where it was last found in a dic
+        } member;
+    };
+};
+
+// immutable once decoded, but for member caches, so shared by every run and every copy of a function
+struct code {
+    struct instruction *instructions;
+    uint32_t length;                        // number of instructions
+    uint32_t refs;                          // reference count
+    uint32_t slots;                         // number of local variable slots, including nested blocks
+    struct byte_array **names;              // name of each slot, borrowed from the instructions
+};
+
+struct code *code_new(struct context *context, const struct byte_array *program);
+struct code *code_retain(struct code *code);
+void code_del(struct context *context, struct code *code);  // releases a reference
+void code_intern_del(struct context *context);              // when the VM is done
+
+#endif // CODE_H
@@ -31,6 +31,7 @@ uint32_t line;
 static struct token *current_token;
 static struct array* lex_list;
 static struct dic *imports = NULL;
+static struct array *locals = NULL; // names of the current function's local variables, by slot
 //struct byte_array *read_file(const struct byte_array *filename);
 
 static struct context *context;
@@ -1179,6 +1180,49 @@ struct symbol *parse(struct array *list, uint32_t index) {
 
 struct byte_array *generate_code(struct byte_array *code, struct symbol *root);
 
+// slot of a local variable, or -1 if it is found by name (at top level, or in a closure, sys, etc.)
+static int32_t local_slot(const struct byte_array *name) {
+    if (NULL == locals)
+        return -1;
+    for (int32_t i=0; i<locals->length; i++)
+        if (byte_array_equals((struct byte_array*)array_get(locals, i), name))
+            return i;
+    return -1;
+}
+
+static void add_local(struct byte_array *name) {
+    if (local_slot(name) < 0)
+        array_add(locals, name);
+}
+
+// the variables a function assigns are its locals
+static void scan_locals(const struct symbol *root) {
+    if ((root == NULL) || (root->nonterminal == SYMBOL_FDECL)) // nested functions have their own
+        return;
+
+    switch (root->nonterminal) {
+        case SYMBOL_VARIABLE:
+            if (root->exp != RHS)
+                add_local(root->token->string);
+            break;
+        case SYMBOL_ITERATOR:
+            for (int i=0; i<root->list->length; i++)
+                add_local(((struct symbol*)array_get(root->list, i))->token->string);
+            break;
+        case SYMBOL_TRYCATCH:
+            add_local(root->token->string);
+            break;
+        default:
+            break;
+    }
+
+    for (int i=0; i<root->list->length; i++)
+        scan_locals((struct symbol*)array_get(root->list, i));
+    scan_locals(root->index);
+    scan_locals(root->value);
+    scan_locals(root->other);
+}
+
 void generate_step(struct byte_array *code, int count, int action,...) {
     byte_array_add_byte(code, action);
 
@@ -1277,14 +1321,18 @@ void generate_assignment(struct byte_array *code, struct symbol *root) {
 }
 
 void generate_variable(struct byte_array *code, struct symbol *root) {
+    int32_t slot = local_slot(root->token->string);
     enum Opcode op = -1;
     switch (root->exp) {
-        case LHS:   op = VM_SET; break;
-        case RHS:   op = VM_VAR; break;
-        case BHS:   op = VM_STX; break;
+        case LHS:   op = slot < 0 ? VM_SET : VM_STL; break;
+        case RHS:   op = slot < 0 ? VM_VAR : VM_VRL; break;
+        case BHS:   op = slot < 0 ? VM_STX : VM_SXL; break;
         default:    exit_message("bad exp type");
     }
     generate_step(code, 1, op);
+    if (slot >= 0) {
+        serial_encode_int(code, slot);
+    }
     serial_encode_string(code, root->token->string);
 }
 
@@ -1308,16 +1356,25 @@ void generate_fdecl(struct byte_array *code, struct symbol *root) {
         for (int i=0; i<closure->length; i++) {
             struct symbol *name = (struct symbol*)array_get(closure, i);
             serial_encode_string(code, name->token->string);
+            serial_encode_int(code, local_slot(name->token->string));
         }
     } else {
         serial_encode_int(code, 0);
     }
 
+    struct array *outer = locals;
+    locals = array_new();
+    scan_locals(root->index);
+    scan_locals(root->value);
+
     struct byte_array *f = byte_array_new();
     generate_code(f, root->index); // params
     generate_code(f, root->value); // statements
     serial_encode_string(code, f);
     byte_array_del(f);
+
+    array_del(locals);
+    locals = outer;
 }
 
 void generate_pair(struct byte_array *code, struct symbol *root) {
@@ -1359,6 +1416,18 @@ void generate_fcall(struct byte_array *code, struct symbol *root) {
     }
 }
 
+// ++x stores the result back in x, rather than changing a value that may be shared
+static void generate_increment(struct byte_array *code, struct symbol *root) {
+    generate_step(code, 1, VM_INC);
+    struct symbol *operand = root->list->length ? (struct symbol*)array_get(root->list, 0) : NULL;
+    if ((NULL != operand) && (operand->nonterminal == SYMBOL_VARIABLE)) {
+        enum Exp_type exp = operand->exp;
+        operand->exp = BHS;
+        generate_variable(code, operand);
+        operand->exp = exp;
+    }
+}
+
 void generate_math(struct byte_array *code, struct symbol *root) {
     enum Lexeme lexeme = root->token->lexeme;
     enum Opcode op = VM_NIL;
@@ -1380,6 +1449,11 @@ void generate_math(struct byte_array *code, struct symbol *root) {
 
     generate_statements(code, root);
 
+    if (lexeme == LEX_INCR) {
+        generate_increment(code, root);
+        return;
+    }
+
     switch (lexeme) {
         case LEX_PLUS:      op = VM_ADD;    break;
         case LEX_MINUS:     op = VM_SUB;    break;
@@ -1506,6 +1580,7 @@ void generate_iterator(struct byte_array *code, struct symbol *root, enum Opcode
     for (int i=0; i<ator->list->length && i<2; i++) {
         struct symbol *a = array_get(ator->list, i);
         serial_encode_string(code, a->token->string);
+        serial_encode_int(code, local_slot(a->token->string));
     }
     
     if (ator->index) {                                  // WHERE c
@@ -1541,6 +1616,7 @@ void generate_trycatch(struct byte_array *code, struct symbol *root) {
     serial_encode_string(code, trial);
 
     serial_encode_string(code, root->token->string);
+    serial_encode_int(code, local_slot(root->token->string));
     struct byte_array *catcher = generate_code(NULL, root->value);
     serial_encode_string(code, catcher);
 
@@ -1562,7 +1638,10 @@ void generate_stack_trace(struct byte_array *code, const struct token *token) {
     if (!byte_array_equals(path, token->path)) {
         path = byte_array_copy(token->path);
         generate_step(code, 1, VM_FIL);
-        serial_encode_string(code, token->path);
+        if (NULL == token->path)
+            serial_encode_int(code, 0); // an empty name, as for source from sys.interpret
+        else
+            serial_encode_string(code, token->path);
         line = -1;
     }
     if (line != token->at_line) {
@@ -1636,6 +1715,7 @@ struct byte_array *build_string(const struct byte_array *input, const struct byt
     // DEBUGPRINT("lex %d:\n", input_copy->length);
 
     lex_list = array_new();
+    locals = NULL;
     context = context_new(NULL, false, false);
     imports = dic_new(context);
 
@@ -8,6 +8,7 @@
 #include "file.h"
 #include "compile.h"
 #include "interpret.h"
+#include "code.h"
 
 #define FG_MAX_INPUT   256
 #define ERROR_USAGE    "usage: filagree [file]"
@@ -35,7 +36,7 @@ struct context *interpret_string_with(struct context *context, struct byte_array
 }
 
 bool run(struct context *context,
-         struct byte_array *program,
+         struct code *code,
          struct dic *env,
          bool in_context);
 
@@ -58,11 +59,15 @@ void repl() {
 
         struct byte_array *input = byte_array_from_string(str);
         struct byte_array *program = build_string(input, NULL);
+        struct code *code = code_new(context, program);
+        uint32_t pinned = context->pinned->length;
         if (!setjmp(trying)) {
-            run(context, program, NULL, true);
+            run(context, code, NULL, true);
         }
+        vm_unpin(context, pinned); // of loops an error jumped out of
         byte_array_del(input);
         byte_array_del(program);
+        code_del(context, code);
     }
 }
 
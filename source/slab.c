@@ -0,0 +1,175 @@
+//
+//  slab.c
+//  filagree
+//
+//  objects of each size class are carved out of large chunks and recycled through
+//  free lists. Each thread has its own free lists, so allocating takes no lock, and
+//  when a thread exits its free objects go to a depot, for the other threads.
+//
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "slab.h"
+#include "util.h"
+
+#if defined(__SANITIZE_ADDRESS__) && !defined(SLAB_MALLOC)
+#define SLAB_MALLOC // so the address sanitizer sees every object
+#endif
+
+#define SLAB_GRAIN          8                   // size classes are multiples of this
+#define SLAB_MAX            128                 // larger sizes just use malloc
+#define SLAB_CLASSES        (SLAB_MAX / SLAB_GRAIN)
+#define SLAB_CHUNK          (64 * 1024)         // bytes carved up at a time
+#define SLAB_CLASS(size)    (((size) + SLAB_GRAIN - 1) / SLAB_GRAIN - 1)
+
+struct slab_object {                            // while free
+    struct slab_object *next;
+};
+
+struct slab_cache {                             // one per thread
+    struct slab_object *free[SLAB_CLASSES];
+    uint32_t allocs[SLAB_CLASSES];              // counts may wrap, but their difference holds
+    uint32_t frees[SLAB_CLASSES];
+    struct slab_cache *next;                    // in the list of running threads' caches
+};
+
+// shared, under slab_lock
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slab_key;                  // for handing back a cache when its thread exits
+static struct slab_cache *slab_caches = NULL;
+static struct slab_cache slab_depot;            // free objects and counts of exited threads
+static uint32_t slab_carved[SLAB_CLASSES];      // objects ever carved out of chunks
+
+static _Thread_local struct slab_cache *slab_cache = NULL;
+
+static void slab_exit(void *p) {
+    struct slab_cache *cache = (struct slab_cache*)p;
+    pthread_mutex_lock(&slab_lock);
+
+    for (int c=0; c<SLAB_CLASSES; c++) {
+        while (NULL != cache->free[c]) {
+            struct slab_object *o = cache->free[c];
+            cache->free[c] = o->next;
+            o->next = slab_depot.free[c];
+            slab_depot.free[c] = o;
+        }
+        slab_depot.allocs[c] += cache->allocs[c];
+        slab_depot.frees[c] += cache->frees[c];
+    }
+
+    struct slab_cache **link = &slab_caches;
+    while (*link != cache)
+        link = &(*link)->next;
+    *link = cache->next;
+
+    pthread_mutex_unlock(&slab_lock);
+    free(cache);
+}
+
+static void slab_init(void) {
+    assert_message(!pthread_key_create(&slab_key, &slab_exit), "slab key");
+}
+
+static struct slab_cache *slab_thread(void) {
+    if (NULL != slab_cache)
+        return slab_cache;
+
+    pthread_once(&slab_once, &slab_init);
+    struct slab_cache *cache = (struct slab_cache*)calloc(1, sizeof(struct slab_cache));
+    null_check(cache);
+    pthread_setspecific(slab_key, cache);
+
+    pthread_mutex_lock(&slab_lock);
+    cache->next = slab_caches;
+    slab_caches = cache;
+    pthread_mutex_unlock(&slab_lock);
+    return slab_cache = cache;
+}
+
+// all of the depot's free objects, or else a new chunk's worth
+static struct slab_object *slab_refill(int c) {
+    pthread_mutex_lock(&slab_lock);
+    struct slab_object *list = slab_depot.free[c];
+    slab_depot.free[c] = NULL;
+
+    if (NULL == list) {
+        size_t size = (c + 1) * SLAB_GRAIN;
+        uint32_t n = SLAB_CHUNK / size;
+        uint8_t *chunk = (uint8_t*)malloc(SLAB_CHUNK);
+        null_check(chunk);
+        for (uint32_t i=n; i--;) { // so the list is in address order
+            struct slab_object *o = (struct slab_object*)(chunk + i * size);
+            o->next = list;
+            list = o;
+        }
+        slab_carved[c] += n;
+    }
+
+    pthread_mutex_unlock(&slab_lock);
+    return list;
+}
+
+void *slab_alloc(size_t size) {
+#ifndef SLAB_MALLOC
+    if (size && (size <= SLAB_MAX)) {
+        int c = SLAB_CLASS(size);
+        struct slab_cache *cache = slab_thread();
+        struct slab_object *o = cache->free[c];
+        if (NULL == o)
+            o = slab_refill(c);
+        cache->free[c] = o->next;
+        cache->allocs[c]++;
+        return o;
+    }
+#endif
+    void *p = malloc(size);
+    assert_message(NULL != p, "out of memory");
+    return p;
+}
+
+void slab_free(void *p, size_t size) {
+#ifndef SLAB_MALLOC
+    if (size && (size <= SLAB_MAX)) {
+        int c = SLAB_CLASS(size);
+        struct slab_cache *cache = slab_thread();
+        struct slab_object *o = (struct slab_object*)p;
+        o->next = cache->free[c];
+        cache->free[c] = o;
+        cache->frees[c]++;
+        return;
+    }
+#endif
+    free(p);
+}
+
+// bytes of each object of size's class, or 0 for sizes that use malloc
+size_t slab_class_size(size_t size) {
+#ifndef SLAB_MALLOC
+    if (size && (size <= SLAB_MAX))
+        return (SLAB_CLASS(size) + 1) * SLAB_GRAIN;
+#endif
+    return 0;
+}
+
+// objects of size's class in use, and carved but free; both 0 for sizes that use malloc
+void slab_stats(size_t size, uint32_t *live, uint32_t *available) {
+    *live = *available = 0;
+#ifndef SLAB_MALLOC
+    if (!size || (size > SLAB_MAX))
+        return;
+    int c = SLAB_CLASS(size);
+
+    pthread_mutex_lock(&slab_lock);
+    uint32_t allocs = slab_depot.allocs[c];
+    uint32_t frees = slab_depot.frees[c];
+    for (struct slab_cache *cache = slab_caches; NULL != cache; cache = cache->next) {
+        allocs += cache->allocs[c];
+        frees += cache->frees[c];
+    }
+    *live = allocs - frees;
+    *available = slab_carved[c] - *live;
+    pthread_mutex_unlock(&slab_lock);
+#endif
+}
@@ -0,0 +1,20 @@
+//
+//  slab.h
+//  filagree
+//
+//  size-class allocator for the small fixed-size structures made most often:
+//  variables and the headers of arrays, byte_arrays and dics
+//
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+void *slab_alloc(size_t size);
+void slab_free(void *p, size_t size);               // size must match slab_alloc's
+void slab_stats(size_t size, uint32_t *live, uint32_t *available);
+size_t slab_class_size(size_t size);               // of size's class, which other sizes may share
+
+#endif // SLAB_H
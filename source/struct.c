@@ -10,11 +10,19 @@
 #include <assert.h>
 #include <ctype.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FIND_SIMD // AVX2 or SSE2 kernels, chosen at run time by what the processor has
+#include <immintrin.h>
+#endif
+
 #include "vm.h"
 #include "struct.h"
+#include "slab.h"
 #include "util.h"
 
 #define ERROR_BYTE_ARRAY_LEN    "byte array too long"
+#define ERROR_SHARED            "changing a shared byte array"
+#define BYTE_ARRAY_GROWTH       2               // a base buffer's size, per byte it holds when made
 #define GROWTH_FACTOR           2
 
 // array ///////////////////////////////////////////////////////////////////
@@ -26,7 +34,7 @@ struct array *array_new() {
 }
 
 struct array *array_new_size(uint32_t size) {
-    struct array *a = (struct array*)malloc(sizeof(struct array));
+    struct array *a = (struct array*)slab_alloc(sizeof(struct array));
     a->data = a->current = (void**)malloc(size * sizeof(void**));
     a->length = 0;
     a->size = size;
@@ -38,7 +46,7 @@ struct array *array_new_size(uint32_t size) {
 void array_del(struct array *a) {
     //DEBUGPRINT("array_del %p->%p\n", a, a->data);
     free(a->data);
-    free(a);
+    slab_free(a, sizeof(struct array));
 }
 
 uint32_t list_resize(uint32_t size, uint32_t length) {
@@ -90,7 +98,7 @@ void* array_get(const struct array *a, uint32_t index) {
 void array_set(struct array *a, uint32_t index, void* datum) {
     null_check(a);
     uint32_t minlen = index + 1;
-    array_resize(a, minlen);
+    array_resize(a, MAX(minlen, a->length)); // never shrink below what's in use
     //DEBUGPRINT("array_set %d %x\n", index, datum);
     a->data[index] = datum;
     if (a->length <= minlen)
@@ -128,10 +136,10 @@ struct array *array_copy(const struct array* original) {
 }
 
 struct array *array_part(struct array *within, uint32_t start, uint32_t length) {
-    struct array *p = array_copy(within);
-    array_remove(p, start+length, within->length-start-length);
-    array_remove(p, 0, start);
-    array_resize(p, p->length);
+    assert_message(start <= within->length && length <= within->length - start, ERROR_INDEX);
+    struct array *p = array_new_size(length);
+    memcpy(p->data, within->data + start, length * sizeof(void*));
+    p->length = length;
     return p;
 }
 
@@ -154,29 +162,41 @@ struct byte_array *byte_array_new() {
 
 void byte_array_del(struct byte_array* ba) {
     //DEBUGPRINT("byte_array_del %p->%p\n", ba, ba->data);
-    if (NULL != ba->data) {
+    if (ba->refs) { // someone else still has it
+        ba->refs--;
+        return;
+    }
+    if (NULL != ba->base) { // data is the base's
+        byte_array_del(ba->base);
+    } else if (NULL != ba->data) {
         free(ba->data);
     }
-    free(ba);
+    slab_free(ba, sizeof(struct byte_array));
 }
 
 struct byte_array *byte_array_new_size(uint32_t size) {
-    struct byte_array* ba = (struct byte_array*)malloc(sizeof(struct byte_array));
+    struct byte_array* ba = (struct byte_array*)slab_alloc(sizeof(struct byte_array));
     ba->data = ba->current = (uint8_t*)malloc(size);
     ba->length = 0;
     ba->size = size;
+    ba->hash = 0;
+    ba->refs = 0;
+    ba->base = NULL;
+    ba->spare = false;
     //DEBUGPRINT("byte_array_new_size %p->%p\n", ba, ba->data);
     return ba;
 }
 
 struct byte_array *byte_array_new_data(uint32_t size, uint8_t *data) {
     struct byte_array *ba = byte_array_new();
+    free(ba->data);
     ba->size = ba->length = size;
     ba->data = ba->current = data;
     return ba;
 }
 
 void byte_array_resize(struct byte_array* ba, uint32_t size) {
+    assert_message(NULL == ba->base, ERROR_SHARED);
     if (!(size = list_resize(ba->size, size))) { // didn't resize
         return;
     }
@@ -196,10 +216,29 @@ bool byte_array_equals(const struct byte_array *a, const struct byte_array* b) {
         return false;
     } else if (a->length != b->length) {
         return false;
+    } else if (a->hash && b->hash && (a->hash != b->hash)) {
+        return false;
     }
     return !memcmp(a->data, b->data, a->length * sizeof(uint8_t));
 }
 
+// FNV-1a, computed once and cached until the byte_array changes
+uint32_t byte_array_hash(const struct byte_array *ba) {
+    if (ba->hash) {
+        return ba->hash;
+    }
+    uint32_t hash = 2166136261u;
+    for (uint32_t i=0; i<ba->length; i++) {
+        hash ^= ba->data[i];
+        hash *= 16777619u;
+    }
+    if (!hash) { // 0 means not cached
+        hash = 1;
+    }
+    ((struct byte_array*)ba)->hash = hash;
+    return hash;
+}
+
 struct byte_array *byte_array_copy(const struct byte_array* original) {
     if (original == NULL) {
         return NULL;
@@ -207,14 +246,17 @@ struct byte_array *byte_array_copy(const struct byte_array* original) {
     struct byte_array* copy = byte_array_new_size(original->size);
     memcpy(copy->data, original->data, original->length);
     copy->length = original->length;
+    copy->hash = original->hash;
     copy->current = copy->data + (original->current - original->data);
     return copy;
 }
 
 void byte_array_set(struct byte_array *within, uint32_t index, uint8_t byte) {
     null_check(within);
+    assert_message(!within->refs && (NULL == within->base), ERROR_SHARED);
     assert_message(index < within->length, "out of bounds");
     within->data[index] = byte;
+    within->hash = 0;
 }
 
 uint8_t byte_array_get(const struct byte_array *within, uint32_t index) {
@@ -226,28 +268,41 @@ uint8_t byte_array_get(const struct byte_array *within, uint32_t index) {
 void byte_array_append(struct byte_array *a, const struct byte_array* b) {
     null_check(a);
     null_check(b);
+    assert_message(!a->refs && (NULL == a->base), ERROR_SHARED);
     uint32_t offset = a->length;
     uint32_t newlen = a->length + b->length;
     byte_array_resize(a, newlen);
     memcpy(&a->data[offset], b->data, b->length);
     a->length = newlen;
+    a->hash = 0;
     a->current = a->data + newlen;
 }
 
 void byte_array_remove(struct byte_array *self, uint32_t start, int32_t length) {
+    assert_message(!self->refs && (NULL == self->base), ERROR_SHARED);
     list_remove(self->data, &self->length, start, length, sizeof(uint8_t));
     byte_array_resize(self, self->length);
+    self->hash = 0;
     //DEBUGPRINT("byte_array_remove %p->%p\n", self, self->data);
 }
 
 struct byte_array *byte_array_part(struct byte_array *within, uint32_t start, uint32_t length) {
-    struct byte_array *p = byte_array_copy(within);
-    byte_array_remove(p, start+length, within->length-start-length);
-    byte_array_remove(p, 0, start);
-    byte_array_resize(p, p->length);
+    assert_message(start <= within->length && length <= within->length - start, ERROR_INDEX);
+    struct byte_array *p = byte_array_new_size(length);
+    memcpy(p->data, within->data + start, length);
+    p->length = length;
     return p;
 }
 
+// the part of within from start, for length, without copying: within stays unchanged while it lasts
+struct byte_array *byte_array_slice(struct byte_array *within, uint32_t start, uint32_t length) {
+    assert_message(start <= within->length && length <= within->length - start, ERROR_INDEX);
+    struct byte_array *slice = byte_array_new_data(length, within->data + start);
+    slice->current = slice->data + length;
+    slice->base = byte_array_share(NULL != within->base ? within->base : within);
+    return slice;
+}
+
 struct byte_array *byte_array_from_string(const char* str) {
     int len = (int)strlen(str);
     struct byte_array* ba = byte_array_new_size(len);
@@ -257,6 +312,24 @@ struct byte_array *byte_array_from_string(const char* str) {
     return ba;
 }
 
+// another reference to ba, which stays unchanged until every holder but one lets go
+struct byte_array *byte_array_share(struct byte_array *ba) {
+    if (NULL != ba) {
+        ba->refs++;
+    }
+    return ba;
+}
+
+// ba, for changing: if shared, a copy of it takes the place of this reference
+struct byte_array *byte_array_own(struct byte_array *ba) {
+    if ((NULL == ba) || (!ba->refs && (NULL == ba->base))) {
+        return ba;
+    }
+    struct byte_array *copy = byte_array_copy(ba);
+    byte_array_del(ba);
+    return copy;
+}
+
 char* byte_array_to_string(const struct byte_array* ba) {
     int len = ba->length;
     char* s = (char*)malloc(len+1);
@@ -290,11 +363,41 @@ struct byte_array *byte_array_concatenate(int n, const struct byte_array* ba, ..
     return result;
 }
 
+// a followed by b, without changing a. The result is on a base buffer with room to spare, and
+// when a ends where the bytes so far in one end, b goes into the room left, so building a
+// string up by appending to it copies each byte only a few times in all.
+struct byte_array *byte_array_extend(struct byte_array *a, const struct byte_array *b) {
+    null_check(a);
+    null_check(b);
+    struct byte_array *base = a->base;
+    uint32_t length = a->length + b->length;
+    assert_message((length >= a->length) && (length <= UINT32_MAX / BYTE_ARRAY_GROWTH), ERROR_BYTE_ARRAY_LEN);
+
+    if ((NULL == base) || !base->spare ||
+        (a->data + a->length != base->data + base->length) || (b->length > base->size - base->length)) {
+        base = byte_array_new_size(length * BYTE_ARRAY_GROWTH);
+        memcpy(base->data, a->data, a->length);
+        base->length = a->length;
+        base->spare = true;
+    } else {
+        byte_array_share(base);
+    }
+    memcpy(base->data + base->length, b->data, b->length);
+    base->length += b->length;
+
+    struct byte_array *result = byte_array_new_data(length, base->data + base->length - length);
+    result->current = result->data + length;
+    result->base = base;
+    return result;
+}
+
 struct byte_array *byte_array_add_byte(struct byte_array *a, uint8_t b) {
+    assert_message(!a->refs && (NULL == a->base), ERROR_SHARED);
     a->length++;
     byte_array_resize(a, a->length);
     a->current = a->data + a->length;
     a->data[a->length-1] = b;
+    a->hash = 0;
     return a;
 }
 
@@ -308,6 +411,71 @@ void byte_array_print(char* into, size_t size, const struct byte_array* ba) {
     }
 }
 
+// where sought (of length m > 0) first is in within (of length n), or -1
+typedef int32_t (find_kernel)(const uint8_t *within, int32_t n, const uint8_t *sought, int32_t m);
+
+static int32_t find_scalar(const uint8_t *within, int32_t n, const uint8_t *sought, int32_t m) {
+    const uint8_t *p = within, *end = within + n - m + 1; // where a match may start
+    while ((p < end) && (NULL != (p = (const uint8_t*)memchr(p, sought[0], end - p)))) {
+        if ((p[m-1] == sought[m-1]) && !memcmp(p, sought, m))
+            return (int32_t)(p - within);
+        p++;
+    }
+    return -1;
+}
+
+// compares a vector of places to start with sought's first byte, and the same places
+// shifted to its last byte, so only the places where both match are compared in full
+#define FIND_VECTOR(width, vector, load, set1, cmpeq, and, movemask)                     \
+    const vector first = set1((char)sought[0]);                                         \
+    const vector last = set1((char)sought[m-1]);                                        \
+    int32_t i = 0;                                                                      \
+    for (; i + m - 1 + width <= n; i += width) {                                        \
+        vector f = cmpeq(first, load((const vector*)(within + i)));                     \
+        vector l = cmpeq(last, load((const vector*)(within + i + m - 1)));              \
+        for (uint32_t mask = (uint32_t)movemask(and(f, l)); mask; mask &= mask - 1) {   \
+            int32_t at = i + __builtin_ctz(mask);                                       \
+            if (!memcmp(within + at, sought, m))                                        \
+                return at;                                                              \
+        }                                                                               \
+    }                                                                                   \
+    int32_t rest = find_scalar(within + i, n - i, sought, m);                           \
+    return rest < 0 ? -1 : i + rest;
+
+#ifdef FIND_SIMD
+
+__attribute__((target("avx2")))
+static int32_t find_avx2(const uint8_t *within, int32_t n, const uint8_t *sought, int32_t m) {
+    FIND_VECTOR(32, __m256i, _mm256_loadu_si256, _mm256_set1_epi8, _mm256_cmpeq_epi8,
+                _mm256_and_si256, _mm256_movemask_epi8)
+}
+
+__attribute__((target("sse2")))
+static int32_t find_sse2(const uint8_t *within, int32_t n, const uint8_t *sought, int32_t m) {
+    FIND_VECTOR(16, __m128i, _mm_loadu_si128, _mm_set1_epi8, _mm_cmpeq_epi8,
+                _mm_and_si128, _mm_movemask_epi8)
+}
+
+#endif // FIND_SIMD
+
+static find_kernel *find_choose(void) {
+#ifdef FIND_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return &find_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return &find_sse2;
+#endif
+    return &find_scalar;
+}
+
+static int32_t find(const uint8_t *within, int32_t n, const uint8_t *sought, int32_t m) {
+    static find_kernel *kernel = NULL; // every thread that sets it sets it the same
+    if (NULL == kernel)
+        kernel = find_choose();
+    return kernel(within, n, sought, m);
+}
+
 int32_t byte_array_find(struct byte_array *within, struct byte_array *sought, int32_t start) {
     null_check(within);
     null_check(sought);
@@ -315,9 +483,17 @@ int32_t byte_array_find(struct byte_array *within, struct byte_array *sought, in
     int32_t ws = within->length;
     int32_t ss = sought->length;
 
-    bool reverse = (start < 0);
-    int32_t not_found = reverse ? (start + ws + 1) : -1;
+    if (start >= 0) { // forward search
+        if (start + ss > ws)
+            return -1;
+        if (!ss)
+            return start;
+        int32_t at = find(within->data + start, ws - start, sought->data, ss);
+        return at < 0 ? -1 : start + at;
+    }
 
+    // reverse search
+    int32_t not_found = start + ws + 1;
     if ((start + ss) >= (int32_t)within->length) {
         return not_found;
     }
@@ -325,39 +501,41 @@ int32_t byte_array_find(struct byte_array *within, struct byte_array *sought, in
     uint8_t *wd = within->data;
     uint8_t *sd = sought->data;
 
-    if (!reverse) { // forward search
-        for (int32_t i=start; i<=ws-ss; i++)
-            if (!memcmp(wd + i, sd, ss))
-                return i;
-
-    } else { // reverse search
-        for (int32_t i=ws-ss+start+2; i>=0; i--) {
-            if (!memcmp(wd + i, sd, ss)) {
-                return i;
-            }
+    for (int32_t i=ws-ss+start+2; i>=0; i--) {
+        if (!memcmp(wd + i, sd, ss)) {
+            return i;
         }
     }
     return not_found;
 }
 
+// original, with each of its non-overlapping occurrences of a, from the start, replaced by b
 struct byte_array *byte_array_replace_all(struct byte_array *original, struct byte_array *a, struct byte_array *b) {
-    /*DEBUGPRINT("replace in %s: %s -> %s\n",
-               byte_array_to_string(original),
-               byte_array_to_string(a),
-               byte_array_to_string(b));*/
-
-    struct byte_array *replaced = byte_array_copy(original);
-    int32_t where = 0;
-
-    for (;;) { // replace all
-
-        if ((where = byte_array_find(replaced, a, where)) < 0) {
-            break;
-        }
-        struct byte_array *replaced2 = byte_array_replace(replaced, b, where++, a->length);
-        byte_array_del(replaced);
-        replaced = replaced2;
-    }
+    null_check(original);
+    null_check(a);
+    null_check(b);
+    int32_t n = original->length, m = a->length;
+    if (!m)
+        return byte_array_copy(original);
+
+    uint32_t count = 0;
+    for (int32_t at = 0, next; (next = find(original->data + at, n - at, a->data, m)) >= 0; at += next + m)
+        count++;
+    if (!count)
+        return byte_array_copy(original);
+
+    uint32_t length = n + count * b->length - count * m;
+    struct byte_array *replaced = byte_array_new_size(length);
+    uint8_t *to = replaced->data;
+    for (int32_t at = 0, next; count--; at += next + m) {
+        next = find(original->data + at, n - at, a->data, m);
+        memcpy(to, original->data + at, next);
+        memcpy(to + next, b->data, b->length);
+        to += next + b->length;
+        if (!count) // the rest, after the last
+            memcpy(to, original->data + at + next + m, n - at - next - m);
+    }
+    replaced->length = length;
     return replaced;
 }
 
@@ -406,6 +584,7 @@ void byte_array_format(struct byte_array *ba, bool append, const char *format, .
             ba->length = (uint32_t)(ba->length + MIN(written-1, capacity));
             ba->current = ba->data + ba->length;
         }
+        ba->hash = 0;
 
         va_end(args);
 
@@ -414,92 +593,80 @@ void byte_array_format(struct byte_array *ba, bool append, const char *format, .
 
 // stack ////////////////////////////////////////////////////////////////////
 
+#define STACK_SIZE 64
+
 struct stack *stack_new() {
-    return (struct stack*)calloc(sizeof(struct stack), 1);
+    struct stack *stack = (struct stack*)malloc(sizeof(struct stack));
+    assert_message(NULL != stack, ERROR_NULL);
+    stack->data = (void**)malloc(STACK_SIZE * sizeof(void*));
+    null_check(stack->data);
+    stack->depth = 0;
+    stack->size = STACK_SIZE;
+    return stack;
 }
 
 void stack_del(struct stack *s) {
-    struct stack_node *sn = s->head;
-    while (sn) {
-        struct stack_node *oldnode = sn;
-        sn = sn->next;
-        free(oldnode);
-    }
+    free(s->data);
     free(s);
 }
 
-struct stack_node* stack_node_new() {
-    return (struct stack_node*)calloc(sizeof(struct stack_node), 1);
-}
-
 uint32_t stack_depth(struct stack *stack) {
-    uint32_t i;
-    struct stack_node *sn = stack->head;
-    for (i=0; sn; i++, sn=sn->next);
-    return i;
+    return stack->depth;
 }
 
 void stack_push(struct stack *stack, void* data) {
     null_check(data);
-    if (stack->head == NULL) {
-        stack->head = stack->tail = stack_node_new();
-    } else {
-        struct stack_node* old_head = stack->head;
-        stack->head = stack_node_new();
-        null_check(stack->head);
-        stack->head->next = old_head;
+    if (stack->depth == stack->size) {
+        stack->size *= 2;
+        stack->data = (void**)realloc(stack->data, stack->size * sizeof(void*));
+        null_check(stack->data);
     }
-    stack->head->data = data;
+    stack->data[stack->depth++] = data;
     //DEBUGPRINT("stack_push %x to %x:%d\n", data, stack, stack_depth(stack));
 }
 
 void* stack_pop(struct stack *stack) {
-    if (stack->head == NULL) {
+    if (stack->depth == 0) {
         return NULL;
     }
-    void* data = stack->head->data;
-    struct stack_node *oldnode = stack->head;
-    stack->head = stack->head->next;
-    if (stack->head == NULL) {
-        stack->tail = NULL;
-    }
-    if (NULL != oldnode) {
-        free(oldnode);
-    }
+    void* data = stack->data[--stack->depth];
     null_check(data);
     //DEBUGPRINT("stack_pop %x from %x:%d\n", data, stack, stack_depth(stack));
     return data;
 }
 
-void* stack_peek(const struct stack *stack, uint8_t index) {
+// index counts down from the top
+void* stack_peek(const struct stack *stack, uint32_t index) {
     null_check(stack);
-    struct stack_node *p = stack->head;
-    for (; index && p; index--, p=p->next);
-    return p ? p->data : NULL;
+    return index < stack->depth ? stack->data[stack->depth - 1 - index] : NULL;
 }
 
 bool stack_empty(const struct stack *stack) {
     null_check(stack);
-    return stack->head == NULL;
+    return stack->depth == 0;
 }
 
 // dic /////////////////////////////////////////////////////////////////////
+//
+// entries are kept in insertion order, in one block after an open-addressed
+// index of entry numbers, which is probed linearly. removed entries keep
+// their place in the index, with a NULL key, until the next resize.
+
+#define DIC_CAPACITY        8                       // initial index size, a power of 2
+#define DIC_USABLE(cap)     ((cap) - (cap) / 4)     // entries that fit, at 3/4 load
+#define DIC_EMPTY           0                       // index slot not used; others are entry number + 1
 
 static int32_t default_hashor(const void *x, void *context) {
     const struct variable *key = (const struct variable*)x;
     switch (key->type) {
-        case VAR_INT:
-            return key->integer;
+        case VAR_INT: { // spread integers across the index, which is masked by the low bits
+            uint32_t h = (uint32_t)key->integer * 2654435761u;
+            return (int32_t)(h ^ (h >> 16));
+        }
         case VAR_FNC:
         case VAR_BYT:
-        case VAR_STR: {
-            const struct byte_array *name = key->str;
-            int32_t hash = 0;
-            int i = 0;
-            for (i = 0; i<name->length; i++)
-                hash += name->data[i];
-            return hash;
-        }
+        case VAR_STR:
+            return (int32_t)byte_array_hash(key->str);
         case VAR_NIL:
             return 0;
             break;
@@ -523,21 +690,17 @@ static void *default_copyor(const void *key, void *context) {
 static void default_rm(const void *key, void *context) {}
 
 struct dic* dic_new_ex(void *context, dic_compare *mc, dic_hash *mh, dic_copyor *my, dic_rm *md) {
-    struct dic *m;
-    if ((m =(struct dic*)malloc(sizeof(struct dic))) == NULL) {
-        return NULL;
-    }
+    struct dic *m = (struct dic*)slab_alloc(sizeof(struct dic));
     m->context = context;
-    m->size = 16;
     m->hash_func = mh ? mh : &default_hashor;
     m->comparator = mc ? mc : &default_comparator;
     m->deletor = md ? md : & default_rm;
     m->copyor = my ? my : &default_copyor;
 
-    if ((m->nodes = (struct hash_node**)calloc(m->size, sizeof(struct hash_node*))) == NULL) {
-        free(m);
-        return NULL;
-    }
+    // allocated on first insert
+    m->index = NULL;
+    m->entries = NULL;
+    m->capacity = m->used = m->count = m->iterators = 0;
 
     //DEBUGPRINT("dic_new %p\n", m);
     return m;
@@ -549,147 +712,186 @@ struct dic* dic_new(void *context) {
 
 void dic_del(struct dic *m) {
     //DEBUGPRINT("dic_del %p\n", m);
-    struct hash_node *node, *oldnode;
-
-    for (size_t n = 0; n<m->size; ++n) {
-        node = m->nodes[n];
-        while (node) {
-            m->deletor(node->key, m->context);
-            oldnode = node;
-            node = node->next;
-            free(oldnode);
-        }
-    }
-    free(m->nodes);
-    free(m);
+    for (uint32_t i=0; i<m->used; i++)
+        if (NULL != m->entries[i].key)
+            m->deletor(m->entries[i].key, m->context);
+    free(m->index); // entries are in the same block
+    slab_free(m, sizeof(struct dic));
 }
 
 bool dic_key_equals(const struct dic *m1, const void *key1, const void *key2) {
     return m1->comparator(key1, key2, m1->context);
 }
 
-int dic_insert(struct dic *m, const void *key, void *data) {
-    struct hash_node *node;
-    int32_t hash = m->hash_func(key, m->context) % m->size;
-
-    node = m->nodes[hash];
-    while (node) {
-        if (dic_key_equals(m, node->key, key)) {
-            node->data = data;
-            return 0;
+// entry number of key, or -1 with the empty index slot where it would go
+static int32_t dic_find(const struct dic *m, const void *key, uint32_t hash, uint32_t *slot) {
+    uint32_t mask = m->capacity - 1;
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        uint32_t e = m->index[i];
+        if (e == DIC_EMPTY) {
+            if (NULL != slot)
+                *slot = i;
+            return -1;
         }
-        node = node->next;
+        const struct dic_entry *entry = &m->entries[e - 1];
+        if ((NULL != entry->key) && (entry->hash == hash) && dic_key_equals(m, entry->key, key))
+            return e - 1;
     }
+}
 
-    if ((node = (struct hash_node*)malloc(sizeof(struct hash_node))) == NULL) {
+// rebuilds the index with room for more entries, dropping removed ones unless iterated
+static int dic_resize(struct dic *m) {
+    uint32_t keep = m->iterators ? m->used : m->count;
+    uint32_t capacity = DIC_CAPACITY;
+    while (DIC_USABLE(capacity) < 2 * (keep + 1))
+        capacity *= 2;
+
+    size_t index_size = capacity * sizeof(uint32_t);
+    uint32_t *index = (uint32_t*)calloc(1, index_size + DIC_USABLE(capacity) * sizeof(struct dic_entry));
+    if (NULL == index) {
         return -1;
     }
-    if ((node->key = m->copyor(key, m->context)) == NULL) {
-        free(node);
+    struct dic_entry *entries = (struct dic_entry*)((uint8_t*)index + index_size);
+
+    uint32_t used = 0, mask = capacity - 1;
+    for (uint32_t i=0; i<m->used; i++) {
+        const struct dic_entry *entry = &m->entries[i];
+        if (NULL == entry->key) {
+            if (m->iterators) // so cursors still point at the same entries
+                entries[used++] = *entry;
+            continue;
+        }
+        uint32_t j = entry->hash & mask;
+        while (index[j] != DIC_EMPTY)
+            j = (j + 1) & mask;
+        entries[used] = *entry;
+        index[j] = ++used;
+    }
+
+    free(m->index);
+    m->index = index;
+    m->entries = entries;
+    m->capacity = capacity;
+    m->used = used;
+    return 0;
+}
+
+int dic_insert(struct dic *m, const void *key, void *data) {
+    uint32_t hash = (uint32_t)m->hash_func(key, m->context);
+    uint32_t slot = 0;
+    int32_t e = m->index ? dic_find(m, key, hash, &slot) : -1;
+    if (e >= 0) {
+        m->entries[e].data = data;
+        return 0;
+    }
+
+    if ((m->used == DIC_USABLE(m->capacity)) || (NULL == m->index)) {
+        if (dic_resize(m)) {
+            return -1;
+        }
+        dic_find(m, key, hash, &slot);
+    }
+
+    void *key2 = m->copyor(key, m->context);
+    if (NULL == key2) {
         return -1;
     }
-    node->data = data;
-    node->next = m->nodes[hash];
-    m->nodes[hash] = node;
+    struct dic_entry *entry = &m->entries[m->used];
+    entry->key = key2;
+    entry->data = data;
+    entry->hash = hash;
+    m->index[slot] = ++m->used;
+    m->count++;
 
     return 0;
 }
 
+// the next entry at or after *cursor, in insertion order; start with *cursor at 0
+bool dic_next(const struct dic *m, uint32_t *cursor, void **key, void **data) {
+    if (NULL == m) {
+        return false;
+    }
+    while (*cursor < m->used) {
+        const struct dic_entry *entry = &m->entries[(*cursor)++];
+        if ((NULL != entry->key) && (NULL != entry->data)) {
+            if (NULL != key)
+                *key = entry->key;
+            if (NULL != data)
+                *data = entry->data;
+            return true;
+        }
+    }
+    return false;
+}
+
 struct array* dic_keys(const struct dic *m) {
     null_check(m);
-    struct array *a = array_new();
-    for (int i=0; i<m->size; i++)
-        for (const struct hash_node* n = m->nodes[i]; n; n=n->next)
-            if (n->data)
-                array_add(a, n->key);
+    struct array *a = array_new_size(m->count);
+    void *key;
+    for (uint32_t i=0; dic_next(m, &i, &key, NULL);)
+        array_add(a, key);
     //DEBUGPRINT("dic_keys %p\n", a);
     return a;
 }
 
 struct array* dic_vals(const struct dic *m) {
-    struct array *a = array_new();
-    for (int i=0; i<m->size; i++)
-        for (const struct hash_node* n = m->nodes[i]; n; n=n->next)
-            if (n->data)
-                array_add(a, n->data);
+    struct array *a = array_new_size(m->count);
+    void *data;
+    for (uint32_t i=0; dic_next(m, &i, NULL, &data);)
+        array_add(a, data);
     return a;
 }
 
 int dic_remove(struct dic *m, const void *key) {
-    struct hash_node *node, *prevnode = NULL;
-    size_t hash = m->hash_func(key, m->context)%m->size;
-
-    node = m->nodes[hash];
-    while(node) {
-        if (dic_key_equals(m, node->key, key)) {
-            m->deletor(node->key, m->context);
-            if (prevnode) {
-                prevnode->next = node->next;
-            } else {
-                m->nodes[hash] = node->next;
-            }
-            free(node);
-            return 0;
-        }
-        prevnode = node;
-        node = node->next;
+    if (NULL == m->index) {
+        return -1;
     }
-    return -1;
+    uint32_t hash = (uint32_t)m->hash_func(key, m->context);
+    int32_t e = dic_find(m, key, hash, NULL);
+    if (e < 0) {
+        return -1;
+    }
+    struct dic_entry *entry = &m->entries[e];
+    m->deletor(entry->key, m->context);
+    entry->key = entry->data = NULL;
+    m->count--;
+    return 0;
 }
 
 bool dic_has(const struct dic *m, const void *key) {
-    struct hash_node *node;
-    size_t hash = m->hash_func(key, m->context) % m->size;
-    node = m->nodes[hash];
-    while (node) {
-        if (dic_key_equals(m, node->key, key))
-            return true;
-        node = node->next;
+    if (NULL == m->index) {
+        return false;
     }
-    return false;
+    uint32_t hash = (uint32_t)m->hash_func(key, m->context);
+    return dic_find(m, key, hash, NULL) >= 0;
 }
 
 void *dic_get(const struct dic *m, const void *key) {
-    if (NULL == m) {
+    if ((NULL == m) || (NULL == m->index)) {
         return NULL;
     }
-    struct hash_node *node;
-    size_t hash = m->hash_func(key, m->context) % m->size;
-    node = m->nodes[hash];
-    while (node) {
-        if (dic_key_equals(m, node->key, key))
-            return node->data;
-        node = node->next;
-    }
-    return NULL;
+    uint32_t hash = (uint32_t)m->hash_func(key, m->context);
+    int32_t e = dic_find(m, key, hash, NULL);
+    return e < 0 ? NULL : m->entries[e].data;
 }
 
-int dic_resize(struct dic *m, size_t size) {
-    //DEBUGPRINT("dic_resize\n");
-    struct dic newtbl;
-    size_t n;
-    struct hash_node *node,*next;
-
-    newtbl.size = size;
-    newtbl.hash_func = m->hash_func;
-
-    if ((newtbl.nodes = (struct hash_node**)calloc(size, sizeof(struct hash_node*))) == NULL) {
-        return -1;
+// dic_get, trying first the entry number in hint, e.g. where key was last found in a dic made
+// the same way, whose keys went in in the same order. A miss sets hint to where key is.
+void *dic_get_hinted(const struct dic *m, const void *key, uint32_t *hint) {
+    if ((NULL == m) || (NULL == m->index)) {
+        return NULL;
     }
-
-    for (n = 0; n<m->size; ++n) {
-        for (node = m->nodes[n]; node; node = next) {
-            next = node->next;
-            dic_insert(&newtbl, node->key, node->data);
-            dic_remove(m, node->key);
-        }
+    if (*hint < m->used) {
+        const struct dic_entry *entry = &m->entries[*hint];
+        if ((NULL != entry->key) && dic_key_equals(m, entry->key, key))
+            return entry->data;
     }
-
-    free(m->nodes);
-    m->size = newtbl.size;
-    m->nodes = newtbl.nodes;
-
-    return 0;
+    uint32_t hash = (uint32_t)m->hash_func(key, m->context);
+    int32_t e = dic_find(m, key, hash, NULL);
+    if (e < 0)
+        return NULL;
+    *hint = e;
+    return m->entries[e].data;
 }
 
 // a - b
@@ -697,14 +899,12 @@ struct dic *dic_minus(struct dic *a, const struct dic *b) {
     if ((a == NULL) || (b == NULL)) {
         return a;
     }
-    struct array *keys = dic_keys(b);
-    for (int i=0; i<keys->length; i++) {
-        const void *key = array_get(keys, i);
+    void *key;
+    for (uint32_t i=0; dic_next(b, &i, &key, NULL);) {
         if (dic_has(a, key)) {
             dic_remove(a, key);
         }
     }
-    array_del(keys);
     return a;
 }
 
@@ -716,17 +916,14 @@ struct dic *dic_union(struct dic *a, const struct dic *b) {
     if (a == NULL) {
         return dic_copy(b->context, b);
     }
-    struct array *keys = dic_keys(b);
-    for (int i=0; i<keys->length; i++) {
-        const void *key = array_get(keys, i);
+    void *key, *value;
+    for (uint32_t i=0; dic_next(b, &i, &key, &value);) {
         if (!dic_has(a, key)) {
             void *key2 = b->copyor(key, a->context);
-            void *value = dic_get(b, key);
             void *value2 = b->copyor(value, a->context);
             dic_insert(a, key2, value2);
         }
     }
-    array_del(keys);
     return a;
 }
 
@@ -42,6 +42,10 @@ struct byte_array {
 	uint8_t *data, *current;
 	uint32_t length;
     uint32_t size;
+    uint32_t hash;      // cached by byte_array_hash, 0 until then or after a change
+    uint32_t refs;      // holders besides the first, which must not change it while shared
+    struct byte_array *base; // if not NULL, whose buffer data is in, which it never changes
+    bool spare;         // a base from byte_array_extend, whose room past length is free to fill
 };
 
 struct byte_array *byte_array_new(void);
@@ -49,18 +53,23 @@ struct byte_array *byte_array_new_size(uint32_t size);
 struct byte_array *byte_array_new_data(uint32_t size, uint8_t *data);
 struct byte_array *byte_array_from_string(const char* str);
 struct byte_array *byte_array_copy(const struct byte_array* original);
+struct byte_array *byte_array_share(struct byte_array *ba);
+struct byte_array *byte_array_own(struct byte_array *ba);
 struct byte_array *byte_array_add_byte(struct byte_array *a, uint8_t b);
 struct byte_array *byte_array_concatenate(int n, const struct byte_array* ba, ...);
+struct byte_array *byte_array_extend(struct byte_array *a, const struct byte_array *b);
 struct byte_array *byte_array_part(struct byte_array *within, uint32_t start, uint32_t length);
+struct byte_array *byte_array_slice(struct byte_array *within, uint32_t start, uint32_t length);
 struct byte_array *byte_array_replace_all(struct byte_array *original,
                                           struct byte_array *a, struct byte_array *b);
 struct byte_array *byte_array_replace(struct byte_array *within, struct byte_array *replacement,
                                       uint32_t start, int32_t length);
 void    byte_array_append(struct byte_array *a, const struct byte_array* b);
 char*   byte_array_to_string(const struct byte_array* ba);
-void    byte_array_del(struct byte_array* ba);
+void    byte_array_del(struct byte_array* ba);                    // releases a reference
 void    byte_array_reset(struct byte_array* ba);
 bool    byte_array_equals(const struct byte_array *a, const struct byte_array* b);
+uint32_t byte_array_hash(const struct byte_array *ba);
 void    byte_array_print(char* into, size_t size, const struct byte_array* ba);
 int32_t byte_array_find(struct byte_array *within, struct byte_array *sought, int32_t start);
 void    byte_array_remove(struct byte_array *within, uint32_t start, int32_t length);
@@ -70,32 +79,26 @@ void    byte_array_format(struct byte_array *ba, bool append, const char *format
 
 // stack ////////////////////////////////////////////////////////////////////
 
-struct stack_node {
-	void* data;
-	struct stack_node* next;
-};
-
 struct stack {
-	struct stack_node* head;
-	struct stack_node* tail;
+	void **data;        // bottom first
+	uint32_t depth;     // number of items
+	uint32_t size;      // number of items allocated
 };
 
 struct stack* stack_new(void);
 void stack_del(struct stack *s);
-struct stack_node* stack_node_new(void);
-void fifo_push(struct stack* fifo, void* data);
 void stack_push(struct stack* stack, void* data);
 void* stack_pop(struct stack* stack);
-void* stack_peek(const struct stack* stack, uint8_t index);
+void* stack_peek(const struct stack* stack, uint32_t index);
 bool stack_empty(const struct stack* stack);
 uint32_t stack_depth(struct stack *stack);
 
 // dic /////////////////////////////////////////////////////////////////////
 
-struct hash_node {
-	void *key;
+struct dic_entry {
+	void *key;          // NULL once removed
 	void *data;
-	struct hash_node *next;
+	uint32_t hash;
 };
 
 typedef bool (dic_compare)(const void *a, const void *b, void *context);
@@ -105,8 +108,12 @@ typedef void (dic_rm)(const void *x, void *context);
 
 struct dic {
     dic_compare *comparator;
-	size_t size;
-	struct hash_node **nodes;
+    uint32_t *index;            // open-addressed, entry number + 1, or 0 if empty
+    struct dic_entry *entries;  // in insertion order, in the same allocation as index
+    uint32_t capacity;          // size of index, a power of 2
+    uint32_t used;              // entries used, including removed ones
+    uint32_t count;             // entries not removed
+    uint32_t iterators;         // loops running over it, during which entries keep their place
     dic_hash *hash_func;
     dic_rm *deletor;
     dic_copyor *copyor;
@@ -119,9 +126,11 @@ void dic_del(struct dic* dic);
 int dic_insert(struct dic* dic, const void *key, void *data);
 int dic_remove(struct dic* dic, const void *key);
 void *dic_get(const struct dic* dic, const void *key);
+void *dic_get_hinted(const struct dic* dic, const void *key, uint32_t *entry);
 bool dic_has(const struct dic* dic, const void *key);
 struct array* dic_keys(const struct dic* m);
 struct array* dic_vals(const struct dic* m);
+bool dic_next(const struct dic* m, uint32_t *cursor, void **key, void **data);
 struct dic *dic_union(struct dic *a, const struct dic *b);
 struct dic *dic_minus(struct dic *a, const struct dic *b);
 struct dic *dic_copy(void *context, const struct dic *dic);
@@ -107,6 +107,55 @@ struct variable *sys_now(struct context *context) {
     return variable_new_int(context, tv.tv_usec);
 }
 
+// with no argument, asks for a full collection once the statement is done;
+// with a list of nursery, heap, growth and step, tunes the collector instead.
+// Either way, returns the collector's settings and sizes in bytes.
+struct variable *sys_gc(struct context *context) {
+    struct variable *args = (struct variable*)stack_pop(context->operand_stack);
+    struct variable *tuning = param_var(args, 1);
+    if (NULL == tuning) {
+        context->singleton->collect = true;
+    }
+    return garbage_collect_settings(context, tuning);
+}
+
+static void sys_stat(struct context *context, struct variable *stats, const char *name, struct variable *value) {
+    struct variable *key = variable_new_str_chars(context, name);
+    variable_dic_insert(context, stats, key, value);
+}
+
+static struct variable *sys_stat_size(struct context *context, size_t n) {
+    return variable_new_int(context, (int32_t)MIN(n, INT32_MAX));
+}
+
+// what the collector has done, and what's in the heap, by type and in bytes
+struct variable *sys_gc_stats(struct context *context) {
+    stack_pop(context->operand_stack); // sys
+    struct gc_stats gc;
+    garbage_collect_stats(context, &gc);
+
+    struct variable *types = variable_new_list(context, NULL);
+    for (enum VarType t=VAR_NIL; t<VAR_LAST; t++)
+        if (gc.vars[t])
+            sys_stat(context, types, var_type_str(t), variable_new_int(context, gc.vars[t]));
+
+    struct variable *stats = variable_new_list(context, NULL);
+    sys_stat(context, stats, "collections", variable_new_int(context, gc.collections));
+    sys_stat(context, stats, "full", variable_new_int(context, gc.full_collections));
+    sys_stat(context, stats, "steps", variable_new_int(context, gc.steps));
+    sys_stat(context, stats, "pause", variable_new_float(context, gc.pause_total));
+    sys_stat(context, stats, "max_pause", variable_new_float(context, gc.pause_max));
+    sys_stat(context, stats, "vars_before", variable_new_int(context, gc.vars_before));
+    sys_stat(context, stats, "vars_after", variable_new_int(context, gc.vars_after));
+    sys_stat(context, stats, "bytes_before", sys_stat_size(context, gc.bytes_before));
+    sys_stat(context, stats, "bytes_after", sys_stat_size(context, gc.bytes_after));
+    sys_stat(context, stats, "types", types);
+    sys_stat(context, stats, "strings", sys_stat_size(context, gc.string_bytes));
+    sys_stat(context, stats, "arrays", sys_stat_size(context, gc.array_bytes));
+    sys_stat(context, stats, "dics", sys_stat_size(context, gc.dic_bytes));
+    return stats;
+}
+
 // runs bytecode
 struct variable *sys_run(struct context *context) {
     struct variable *value = (struct variable*)stack_pop(context->operand_stack);
@@ -153,7 +202,7 @@ struct variable *sys_atoi(struct context *context) {
 
     variable_push(context, variable_new_int(context, n));
     variable_push(context, variable_new_int(context, i));
-    return variable_new_src(context, 2);
+    return variable_new_src(context, 2, NULL);
 }
 
 char *param_str(const struct variable *value, uint32_t index) {
@@ -245,7 +294,9 @@ struct string_func builtin_funcs[] = {
     {"connect",     &sys_connect},
     {"disconnect",  &sys_disconnect},
     {"exit",        &sys_exit},
-    {"now",         &sys_now}
+    {"now",         &sys_now},
+    {"gc",          &sys_gc},
+    {"gc_stats",    &sys_gc_stats}
 };
 
 struct variable *sys_new(struct context *context) {
@@ -291,9 +342,7 @@ int compar(struct context *context, const void *a, const void *b, struct variabl
         byte_array_reset(comparator->str);
         vm_call(context, comparator, av, bv, NULL);
 
-        struct variable *result = (struct variable*)stack_pop(context->operand_stack);
-        if (result->type == VAR_SRC)
-            result = array_get(result->list.ordered, 0);
+        struct variable *result = variable_pop(context);
         assert_message(result->type == VAR_INT, "non-integer comparison result");
         return result->integer;
 
@@ -428,6 +477,7 @@ static inline struct variable *cfnc_chop(struct context *context, bool snip) {
 
     struct variable *result = variable_part(context, self, beginning, foraslongas);
     if (snip) {
+        self = variable_own(context, self); // not a literal's constant
         variable_remove(self, beginning, foraslongas);
     }
     return result;
@@ -476,6 +526,8 @@ static inline struct variable *cfnc_insert(struct context *context) { // todo: t
     null_check(self);
     null_check(insertion);
     assert_message(!start || start->type == VAR_INT, "non-integer index");
+    self = variable_own(context, self); // not literals' constants
+    insertion = variable_own(context, insertion);
 
     int32_t position = 0;
     switch (self->type) {
@@ -500,11 +552,12 @@ static inline struct variable *cfnc_insert(struct context *context) { // todo: t
     struct variable *joined = variable_concatenate(context, 3, first, insertion, second);
     
     if (self->type == VAR_LST) {
+        variable_barrier(context, self);
         array_del(self->list.ordered);
         self->list.ordered = array_copy(joined->list.ordered);
     } else {
         byte_array_del(self->str);
-        self->str = byte_array_copy(joined->str);
+        self->str = byte_array_share(joined->str);
     } return joined;
 }
 
@@ -531,7 +584,13 @@ static inline struct variable *cfnc_serialize(struct context *context) {
 static inline struct variable *cfnc_deserialize(struct context *context) {
     struct variable *args = (struct variable*)stack_pop(context->operand_stack);
     struct variable *indexable = (struct variable*)array_get(args->list.ordered, 0);
-    struct byte_array *bits = indexable->str;
+    if (variable_immortal(indexable)) { // a literal, shared by all its uses, so decoded from a copy
+        struct byte_array *bits = byte_array_copy(indexable->str);
+        struct variable *result = variable_deserialize(context, bits);
+        byte_array_del(bits);
+        return result;
+    }
+    struct byte_array *bits = indexable->str = byte_array_own(indexable->str); // decoding moves its cursor
     //byte_array_reset(bits);
     return variable_deserialize(context, bits);
 }
@@ -2,16 +2,94 @@
 #include "vm.h"
 #include "util.h"
 #include "struct.h"
+#include "slab.h"
 #include "serial.h"
 #include "variable.h"
 #include "node.h"
+#include "code.h"
 
-extern void mark_dic(struct dic *dic, bool mark);
 static void variable_value2(struct context *context, struct variable* v, struct byte_array *buf);
 static struct variable *variable_deserialize2(struct context *context, struct byte_array *bits);
+static struct variable *variable_window_src(struct context *context, struct variable *marker);
 
 #define ERROR_VAR_TYPE  "type error"
 
+// shared constants, so that nil, booleans and small integers aren't allocated
+#define IMMORTAL_INT_MIN    -128
+#define IMMORTAL_INT_MAX    1023
+
+static struct variable immortal_nil   = {.type = VAR_NIL,  .visited = VISITED_NEVER, .gc_state = GC_SAFE, .generation = GEN_OLD};
+static struct variable immortal_true  = {.type = VAR_BOOL, .visited = VISITED_NEVER, .gc_state = GC_SAFE, .generation = GEN_OLD, .boolean = true};
+static struct variable immortal_false = {.type = VAR_BOOL, .visited = VISITED_NEVER, .gc_state = GC_SAFE, .generation = GEN_OLD, .boolean = false};
+static struct variable immortal_ints[IMMORTAL_INT_MAX - IMMORTAL_INT_MIN + 1];
+
+// markers of windows, one for each count of values under it and of those taken so far
+#define WINDOW_MAX          8
+
+static struct variable immortal_windows[WINDOW_MAX + 1][WINDOW_MAX + 1];
+static pthread_once_t immortal_once = PTHREAD_ONCE_INIT;
+
+static void immortals_init(void) {
+    for (int32_t i=IMMORTAL_INT_MIN; i<=IMMORTAL_INT_MAX; i++) {
+        struct variable *v = &immortal_ints[i - IMMORTAL_INT_MIN];
+        v->type = VAR_INT;
+        v->visited = VISITED_NEVER;
+        v->mark = 0;
+        v->gc_state = GC_SAFE;
+        v->generation = GEN_OLD;
+        v->integer = i;
+    }
+    for (uint32_t i=0; i<=WINDOW_MAX; i++) {
+        for (uint32_t j=0; j<=i; j++) {
+            struct variable *v = &immortal_windows[i][j];
+            v->type = VAR_WIN;
+            v->visited = VISITED_NEVER;
+            v->gc_state = GC_SAFE;
+            v->generation = GEN_OLD;
+            v->window.length = i;
+            v->window.taken = j;
+        }
+    }
+}
+
+// called when the first context is created
+void variable_immortals() {
+    pthread_once(&immortal_once, immortals_init);
+}
+
+// shared constants can't be changed in place
+bool variable_immortal(const struct variable *v) {
+    return v->visited == VISITED_NEVER;
+}
+
+// a literal's shared constant, made when code is decoded and kept while code uses it, so
+// pushing it allocates nothing
+struct variable *variable_new_constant(enum VarType type) {
+    struct variable *v = (struct variable*)slab_alloc(sizeof(struct variable));
+    memset(v, 0, sizeof(struct variable));
+    v->type = type;
+    v->visited = VISITED_NEVER;
+    v->gc_state = GC_SAFE;
+    v->generation = GEN_OLD;
+    return v;
+}
+
+// a constant no code uses any more, but variables may, so the collector frees it once none
+// do; it's still never changed in place
+void variable_release_constant(struct context *context, struct variable *v) {
+    struct context_shared *s = context->singleton;
+    v->gc_state = GC_OLD;
+    v->generation = GEN_RELEASED;
+    v->epoch = s->epoch; // kept by a collection under way, which may have passed what refers to it
+    array_add(s->tenured, v);
+    s->tenured_bytes += variable_size(v);
+}
+
+// a copy of a shared constant, for changing in place, e.g. in a list
+struct variable *variable_own(struct context *context, struct variable *v) {
+    return variable_immortal(v) ? variable_copy(context, v) : v;
+}
+
 const struct number_string var_types[] = {
     {VAR_NIL,   "nil"},
     {VAR_INT,   "integer"},
@@ -21,10 +99,12 @@ const struct number_string var_types[] = {
     {VAR_LST,   "list"},
     {VAR_FNC,   "function"},
     {VAR_ERR,   "error"},
+    {VAR_BYT,   "bytes"},
     {VAR_SRC,   "source"},
     {VAR_BOOL,  "boolean"},
     {VAR_CFNC,  "c-function"},
     {VAR_VOID,  "void"},
+    {VAR_WIN,   "window"},
 };
 
 const char *var_type_str(enum VarType vt) {
@@ -32,7 +112,7 @@ const char *var_type_str(enum VarType vt) {
 }
 
 struct variable* variable_new(struct context *context, enum VarType type) {
-    struct variable* v = (struct variable*)malloc(sizeof(struct variable));
+    struct variable* v = (struct variable*)slab_alloc(sizeof(struct variable));
     //DEBUGPRINT("\n>%" PRIu16 " - variable_new %p %s\n", current_thread_id(), v, var_type_str(type));
 
     v->type = type;
@@ -40,14 +120,11 @@ struct variable* variable_new(struct context *context, enum VarType type) {
     v->ptr = NULL;
     v->visited = VISITED_NOT;
     v->gc_state = GC_NEW;
+    v->generation = GEN_YOUNG;
+    v->epoch = 0;
 
-    struct array *oldarray = context->singleton->all_variables;
-
-    array_add(context->singleton->all_variables, v);
-
-    struct array *newarray = context->singleton->all_variables;
-    if (oldarray != newarray)
-        DEBUGPRINT("all_variables %p -> %p\n", oldarray, newarray);
+    array_add(context->singleton->nursery, v);
+    context->singleton->allocated += sizeof(struct variable);
 
     //DEBUGPRINT("variable_new %s %p\n", var_type_str(type), v);
     return v;
@@ -60,10 +137,12 @@ struct variable *variable_new_void(struct context *context, void *p) {
 }
 
 struct variable* variable_new_nil(struct context *context) {
-    return variable_new(context, VAR_NIL);
+    return &immortal_nil;
 }
 
 struct variable* variable_new_int(struct context *context, int32_t i) {
+    if ((i >= IMMORTAL_INT_MIN) && (i <= IMMORTAL_INT_MAX))
+        return &immortal_ints[i - IMMORTAL_INT_MIN];
     struct variable *v = variable_new(context, VAR_INT);
     v->integer = i;
     return v;
@@ -76,9 +155,15 @@ struct variable* variable_new_err(struct context *context, const char* message)
 }
 
 struct variable* variable_new_bool(struct context *context, bool b) {
-    struct variable *v = variable_new(context, VAR_BOOL);
-    v->boolean = b;
-    return v;
+    return b ? &immortal_true : &immortal_false;
+}
+
+// write barrier, for when v is given references: if v is old, the next minor collection looks in it
+void variable_barrier(struct context *context, struct variable *v) {
+    if (v->generation == GEN_OLD) {
+        v->generation = GEN_REMEMBERED;
+        array_add(context->singleton->remembered, v);
+    }
 }
 
 void variable_old(struct variable *v) {
@@ -107,9 +192,12 @@ void variable_del(struct context *context, struct variable *v) {
                 dic_del(v->list.dic);
             break;
         case VAR_STR:
-        case VAR_FNC:
             byte_array_del(v->str);
             break;
+        case VAR_FNC:
+            byte_array_del(v->fnc.body);
+            code_del(context, v->fnc.code);
+            break;
         case VAR_VOID: // todo
             break;
         default:
@@ -117,17 +205,71 @@ void variable_del(struct context *context, struct variable *v) {
             break;
     }
 
-    free(v);
+    if (GEN_RELEASED == v->generation) // so caches of its address know it may be reused
+        context->singleton->constants_freed++;
+    slab_free(v, sizeof(struct variable));
 }
 
-struct variable *variable_new_src(struct context *context, uint32_t size) {
+// bytes v holds, roughly, not counting the variables it refers to
+size_t variable_size(const struct variable *v) {
+    size_t size = sizeof(struct variable);
+    switch (v->type) {
+        case VAR_SRC:
+        case VAR_LST:
+            size += sizeof(struct array) + v->list.ordered->size * sizeof(void*);
+            if (NULL != v->list.dic)
+                size += sizeof(struct dic) + v->list.dic->capacity * (sizeof(uint32_t) + sizeof(struct dic_entry));
+            break;
+        case VAR_STR:
+        case VAR_BYT:
+        case VAR_ERR:
+            if (NULL != v->str)
+                size += sizeof(struct byte_array) + v->str->size;
+            break;
+        case VAR_FNC:
+            if (NULL != v->fnc.body)
+                size += sizeof(struct byte_array) + v->fnc.body->size;
+            break;
+        default:
+            break;
+    }
+    return size;
+}
+
+// the top size items of the operand stack, after first (e.g. self) unless it's NULL. Lists of
+// values among the items, e.g. what a call returned, are spread, and key-value pairs go in the dic.
+struct variable *variable_new_src(struct context *context, uint32_t size, struct variable *first) {
     struct variable *v = variable_new(context, VAR_SRC);
-    v->list.ordered = array_new();
     v->list.dic = NULL;
 
+    struct stack *stack = context->operand_stack;
+    assert_message(size <= stack->depth, "operand stack underflow");
+    void **items = stack->data + stack->depth - size;
+    bool plain = true;
+    for (uint32_t i=0; plain && (i<size); i++) {
+        enum VarType type = ((struct variable*)items[i])->type;
+        plain = (VAR_SRC != type) && (VAR_KVP != type) && (VAR_WIN != type);
+    }
+
+    if (plain) { // just values, so they're taken as they lie
+        uint32_t at = (NULL != first);
+        v->list.ordered = array_new_size(at + size);
+        if (NULL != first)
+            v->list.ordered->data[0] = first;
+        memcpy(v->list.ordered->data + at, items, size * sizeof(void*));
+        v->list.ordered->length = at + size;
+        v->list.ordered->current = v->list.ordered->data;
+        stack->depth -= size;
+        return v;
+    }
+
+    v->list.ordered = array_new();
     while (size--) {
         struct variable *o = (struct variable*)stack_pop(context->operand_stack);
+        if (o->type == VAR_WIN)
+            o = variable_window_src(context, o);
         if (o->type == VAR_SRC) {
+            variable_barrier(context, o);
             o->list.dic = dic_union(o->list.dic, v->list.dic);
             array_append(o->list.ordered, v->list.ordered);
             v = o;
@@ -137,13 +279,78 @@ struct variable *variable_new_src(struct context *context, uint32_t size) {
             array_insert(v->list.ordered, 0, o);
         }
     }
+    if (NULL != first) {
+        variable_barrier(context, v);
+        array_insert(v->list.ordered, 0, first);
+    }
     v->list.ordered->current = v->list.ordered->data;
     return v;
 }
 
+// the top size items of the operand stack, left where they lie as a window of values, under a
+// marker of how many there are and how many have been assigned. False, and nothing done, unless
+// they are all plain values, or a single window, e.g. what a call returned, which starts over.
+bool variable_new_window(struct context *context, uint32_t size) {
+    struct stack *stack = context->operand_stack;
+    assert_message(size <= stack->depth, "operand stack underflow");
+    void **items = stack->data + stack->depth - size;
+    if ((1 == size) && variable_window((struct variable*)items[0])) {
+        struct variable *marker = (struct variable*)items[0];
+        items[0] = &immortal_windows[marker->window.length][0];
+        return true;
+    }
+    if (size > WINDOW_MAX)
+        return false;
+
+    for (uint32_t i=0; i<size; i++) {
+        enum VarType type = ((struct variable*)items[i])->type;
+        if ((VAR_SRC == type) || (VAR_KVP == type) || (VAR_WIN == type))
+            return false;
+    }
+    stack_push(stack, &immortal_windows[size][0]);
+    return true;
+}
+
+bool variable_window(const struct variable *v) {
+    return VAR_WIN == v->type;
+}
+
+// the next value of the window atop the operand stack, or nil once they're all taken
+struct variable *variable_window_next(struct context *context) {
+    struct stack *stack = context->operand_stack;
+    struct variable *marker = (struct variable*)stack_peek(stack, 0);
+    uint32_t length = marker->window.length;
+    uint32_t taken = marker->window.taken;
+    if (taken == length)
+        return variable_new_nil(context);
+    stack->data[stack->depth - 1] = &immortal_windows[length][taken + 1];
+    return (struct variable*)stack->data[stack->depth - 1 - length + taken];
+}
+
+// pops the window atop the operand stack, values and all
+void variable_window_drop(struct context *context) {
+    struct variable *marker = (struct variable*)stack_pop(context->operand_stack);
+    context->operand_stack->depth -= marker->window.length;
+}
+
+// the values of a window, whose marker was just popped, popped into a list
+static struct variable *variable_window_src(struct context *context, struct variable *marker) {
+    struct stack *stack = context->operand_stack;
+    uint32_t length = marker->window.length;
+    struct variable *v = variable_new(context, VAR_SRC);
+    v->list.dic = NULL;
+    v->list.ordered = array_new_size(length);
+    memcpy(v->list.ordered->data, stack->data + stack->depth - length, length * sizeof(void*));
+    v->list.ordered->length = length;
+    v->list.ordered->current = v->list.ordered->data;
+    stack->depth -= length;
+    return v;
+}
+
 struct variable *variable_new_bytes(struct context *context, struct byte_array *bytes, uint32_t size) {
     struct variable *v = variable_new(context, VAR_BYT);
     v->str = bytes ? bytes : byte_array_new_size(size);
+    context->singleton->allocated += v->str->size;
     return v;
 }
 
@@ -154,23 +361,36 @@ struct variable* variable_new_float(struct context *context, float f) {
     return v;
 }
 
+// bytes that str newly takes up: none of its base's, unless it is the base's only holder
+static uint32_t variable_str_allocated(const struct byte_array *str) {
+    if (NULL == str->base)
+        return str->size;
+    return str->base->refs ? 0 : str->base->size;
+}
+
 struct variable *variable_new_str(struct context *context, struct byte_array *str) {
     struct variable *v = variable_new(context, VAR_STR);
-    v->str = str ? byte_array_copy(str) : byte_array_new();
+    v->str = str ? byte_array_share(str) : byte_array_new(); // so the caller mustn't change str
+    context->singleton->allocated += variable_str_allocated(v->str);
     //DEBUGPRINT("variable_new_str %p->%s\n", v, byte_array_to_string(str));
     return v;
 }
 
 struct variable *variable_new_str_chars(struct context *context, const char *str) {
     struct byte_array *str2 = byte_array_from_string(str);
-    return variable_new_str(context, str2);
+    struct variable *v = variable_new_str(context, str2);
+    byte_array_del(str2);
+    return v;
 }
 
-struct variable *variable_new_fnc(struct context *context, struct byte_array *body, struct variable *closure) {
+// a function of body, decoded into code if it's been already, closed over closure
+struct variable *variable_new_fnc(struct context *context, struct byte_array *body,
+                                  struct code *code, struct variable *closure) {
     //DEBUGPRINT("variable_new_fnc %s\n", buf);
 
     struct variable *v = variable_new(context, VAR_FNC);
-    v->fnc.body = byte_array_copy(body);
+    v->fnc.body = byte_array_share(body);
+    v->fnc.code = code_retain(code);
     if (NULL != closure) {
         v->fnc.closure = dic_copy(context, closure->list.dic);
     } else {
@@ -273,31 +493,35 @@ static void variable_value2(struct context *context, struct variable* v, struct
     }
 
     if (NULL != dic) {
-        struct array *keys = dic_keys(dic);
-        struct array *vals = dic_vals(dic);
-
-        for (int i=0; i<keys->length; i++) {
-            if (v->list.ordered->length + i)
+        struct variable *key, *val;
+        uint32_t n = 0;
+        for (uint32_t i=0; dic_next(dic, &i, (void**)&key, (void**)&val); n++) {
+            if (v->list.ordered->length + n)
                 byte_array_format(buf, true, ",");
 
-            struct variable *key = (struct variable *)array_get(keys, i);
-            struct variable *val = (struct variable *)array_get(vals, i);
             struct variable *kvp = variable_new_kvp(context, key, val);
             variable_value2(context, kvp, buf);
-            kvp->gc_state = GC_OLD;
+            variable_old(kvp);
         }
         byte_array_format(buf, true, "]");
 
-        array_del(keys);
-        array_del(vals);
-
     } else if (vt == VAR_LST || vt == VAR_SRC) {
         byte_array_format(buf, true, "]");
     }
 }
 
+static void variable_mark2(struct variable *v, uint32_t *marker);
+
+static void variable_mark_dic(struct dic *dic, uint32_t *marker) {
+    struct variable *key, *value;
+    for (uint32_t i=0; dic_next(dic, &i, (void**)&key, (void**)&value);) {
+        variable_mark2(key, marker);
+        variable_mark2(value, marker);
+    }
+}
+
 static void variable_mark2(struct variable *v, uint32_t *marker) {
-    if (VISITED_MORE == v->visited) {
+    if ((VISITED_MORE == v->visited) || (VISITED_NEVER == v->visited)) {
         return;
     }
     if (VISITED_ONCE == v->visited) {
@@ -311,23 +535,26 @@ static void variable_mark2(struct variable *v, uint32_t *marker) {
     v->mark = ++(*marker);
     v->visited = VISITED_ONCE;
 
-    if (VAR_LST == v->type) {
+    if (VAR_LST == v->type || VAR_SRC == v->type) {
         for (int i=0; i<v->list.ordered->length; i++) {
             struct variable *v2 = (struct variable*)array_get(v->list.ordered, i);
             if (v2)
                 variable_mark2(v2, marker);
         }
-        mark_dic(v->list.dic, true);
+        variable_mark_dic(v->list.dic, marker);
     } else if (VAR_KVP == v->type) {
         variable_mark2((struct variable*)v->kvp.key, marker);
         variable_mark2((struct variable*)v->kvp.val, marker);
     } else if (VAR_FNC == v->type) {
-        mark_dic(v->fnc.closure, true);
+        variable_mark_dic(v->fnc.closure, marker);
+    } else if (VAR_CFNC == v->type && NULL != v->cfnc.data) {
+        variable_mark2(v->cfnc.data, marker);
     }
 
     //DEBUGPRINT("variable_mark2 %p->%p\n", v, v->dic);
 }
 
+// counts visits, so that variable_value can show references which repeat
 void variable_mark(struct variable *v) {
     if (NULL == v) {
         return;
@@ -336,9 +563,17 @@ void variable_mark(struct variable *v) {
     variable_mark2(v, &marker);
 }
 
+static void variable_unmark_dic(struct dic *dic) {
+    struct variable *key, *value;
+    for (uint32_t i=0; dic_next(dic, &i, (void**)&key, (void**)&value);) {
+        variable_unmark(key);
+        variable_unmark(value);
+    }
+}
+
 void variable_unmark(struct variable *v) {
     assert_message(v->type < VAR_LAST, "corrupt variable");
-    if (VISITED_NOT == v->visited)
+    if ((VISITED_NOT == v->visited) || (VISITED_NEVER == v->visited))
         return;
 
     //DEBUGPRINT("\n>%" PRIu16 " - variable_unmark %p %s\n", current_thread_id(), v, var_type_str(v->type));
@@ -346,18 +581,108 @@ void variable_unmark(struct variable *v) {
     v->mark = 0;
     v->visited = VISITED_NOT;
 
-    if (VAR_LST == v->type) {
+    if (VAR_LST == v->type || VAR_SRC == v->type) {
         for (int i=0; i<v->list.ordered->length; i++) {
             struct variable* element = (struct variable*)array_get(v->list.ordered, i);
             if (NULL != element)
                 variable_unmark(element);
         }
-        mark_dic(v->list.dic, false);
+        variable_unmark_dic(v->list.dic);
     } else if (VAR_KVP == v->type) {
         variable_unmark((struct variable*)v->kvp.key);
         variable_unmark((struct variable*)v->kvp.val);
-    } else if (VAR_FNC == v->type)
-        mark_dic(v->fnc.closure, false);
+    } else if (VAR_FNC == v->type) {
+        variable_unmark_dic(v->fnc.closure);
+    } else if (VAR_CFNC == v->type && NULL != v->cfnc.data) {
+        variable_unmark(v->cfnc.data);
+    }
+}
+
+// garbage collection marks with the collection's epoch rather than visited states, so
+// nothing is unmarked afterwards, and uses a work stack rather than the C stack
+
+static void variable_gc_gray(struct context_shared *s, struct variable *v, enum Marking marking) {
+    if ((NULL == v) || (variable_immortal(v) && (GEN_RELEASED != v->generation)) || (v->epoch == s->epoch))
+        return;
+    bool young = (GEN_YOUNG == v->generation);
+    if ((MARK_YOUNG == marking && !young) ||    // a minor collection stops at the old generation
+        (MARK_OLD == marking && young))         // and an incremental one leaves the nursery to them
+        return;
+    v->epoch = s->epoch;
+    stack_push(MARK_OLD == marking ? s->pending : s->gray, v);
+}
+
+static uint32_t variable_gc_gray_dic(struct context_shared *s, struct dic *dic, enum Marking marking) {
+    struct variable *key, *value;
+    uint32_t n = 0;
+    for (uint32_t i=0; dic_next(dic, &i, (void**)&key, (void**)&value); n++) {
+        variable_gc_gray(s, key, marking);
+        variable_gc_gray(s, value, marking);
+    }
+    return n;
+}
+
+// grays what v refers to, and returns how many
+static uint32_t variable_gc_children(struct context_shared *s, struct variable *v, enum Marking marking) {
+    uint32_t n = 0;
+    switch (v->type) {
+        case VAR_LST:
+        case VAR_SRC:
+            for (; n<v->list.ordered->length; n++)
+                variable_gc_gray(s, (struct variable*)array_get(v->list.ordered, n), marking);
+            n += variable_gc_gray_dic(s, v->list.dic, marking);
+            break;
+        case VAR_KVP:
+            variable_gc_gray(s, v->kvp.key, marking);
+            variable_gc_gray(s, v->kvp.val, marking);
+            n = 2;
+            break;
+        case VAR_FNC:
+            n = variable_gc_gray_dic(s, v->fnc.closure, marking);
+            break;
+        case VAR_CFNC:
+            variable_gc_gray(s, v->cfnc.data, marking);
+            n = 1;
+            break;
+        default:
+            break;
+    }
+    return n;
+}
+
+// marks v and what it refers to, or if young, only what's in the nursery;
+// an incremental collection only grays v, and variable_gc_step does the rest
+void variable_gc_mark(struct context *context, struct variable *v, enum Marking marking) {
+    struct context_shared *s = context->singleton;
+    if ((MARK_YOUNG == marking) && (NULL != v) && (GEN_REMEMBERED == v->generation))
+        variable_gc_children(s, v, marking); // old, but may refer to the nursery
+    else
+        variable_gc_gray(s, v, marking);
+    if (MARK_OLD == marking)
+        return;
+
+    while (!stack_empty(s->gray))
+        variable_gc_children(s, (struct variable*)stack_pop(s->gray), marking);
+}
+
+// for an incremental collection, scans v again, as it may have been given unmarked references
+void variable_gc_rescan(struct context *context, struct variable *v) {
+    struct context_shared *s = context->singleton;
+    if (GEN_YOUNG != v->generation)
+        v->epoch = s->epoch;
+    stack_push(s->pending, v);
+}
+
+// scans gray variables until budget references have been looked at; true if none are left
+bool variable_gc_step(struct context *context, uint32_t *budget) {
+    struct context_shared *s = context->singleton;
+    while (!stack_empty(s->pending)) {
+        if (!*budget)
+            return false;
+        uint32_t n = 1 + variable_gc_children(s, (struct variable*)stack_pop(s->pending), MARK_OLD);
+        *budget = n < *budget ? *budget - n : 0;
+    }
+    return true;
 }
 
 struct byte_array *variable_value(struct context *context, struct variable *v) {
@@ -377,7 +702,12 @@ const char *variable_value_str(struct context *context, struct variable *v) {
 struct variable *variable_pop(struct context *context) {
     struct variable *v = (struct variable*)stack_pop(context->operand_stack);
     null_check(v);
-    if (v->type == VAR_SRC) {
+    if (v->type == VAR_WIN) { // the first value, if any, and the rest dropped
+        struct stack *stack = context->operand_stack;
+        uint32_t length = v->window.length;
+        stack->depth -= length;
+        v = length ? (struct variable*)stack->data[stack->depth] : variable_new_nil(context);
+    } else if (v->type == VAR_SRC) {
         if (v->list.ordered->length) {
             v = (struct variable*)array_get(v->list.ordered, 0);
         } else {
@@ -389,7 +719,8 @@ struct variable *variable_pop(struct context *context) {
 
 void inline variable_push(struct context *context, struct variable *v) {
     stack_push(context->operand_stack, v);
-    v->gc_state = GC_OLD;
+    if (!variable_immortal(v)) // shared constants are never written, as other threads read them
+        v->gc_state = GC_OLD;
     //DEBUGPRINT("\n>%" PRIu16 " - variable_push %p %s\n", current_thread_id(), v, var_type_str(v->type));
 }
 
@@ -399,17 +730,12 @@ void dic_serialize(struct context *context, struct byte_array *bits, struct dic
         return;
     }
 
-    struct array *keys = dic_keys(dic);
-    struct array *values = dic_vals(dic);
-    serial_encode_int(bits, keys->length);
-    for (int i=0; i<keys->length; i++) {
-        const struct variable *key = (const struct variable*)array_get(keys, i);
-        const struct variable *value = (const struct variable*)array_get(values, i);
+    serial_encode_int(bits, dic->count);
+    struct variable *key, *value;
+    for (uint32_t i=0; dic_next(dic, &i, (void**)&key, (void**)&value);) {
         variable_serialize(context, bits, key);
         variable_serialize(context, bits, value);
     }
-    array_del(keys);
-    array_del(values);
 }
 
 struct byte_array *variable_serialize(struct context *context,
@@ -504,7 +830,8 @@ static struct variable *variable_deserialize2(struct context *context, struct by
             break;
         case VAR_FNC:
             str = serial_decode_string(bits);
-            result = variable_new_fnc(context, str, NULL);
+            result = variable_new_fnc(context, str, NULL, NULL);
+            context->singleton->allocated += str->size;
             result->fnc.closure = dic_deserialize(context, bits);
             break;
         case VAR_STR:
@@ -513,7 +840,7 @@ static struct variable *variable_deserialize2(struct context *context, struct by
             break;
         case VAR_BYT:
             str = serial_decode_string(bits);
-            result =  variable_new_bytes(context, str, 0);
+            result =  variable_new_bytes(context, byte_array_share(str), 0);
             break;
         case VAR_LST: {
             uint32_t len = serial_decode_int(bits);
@@ -577,7 +904,9 @@ struct variable *variable_part(struct context *context,
         case VAR_STR: {
             if (start >= self->str->length)
                 return variable_new_str(context, NULL);
-            struct byte_array *str = byte_array_part(self->str, start, length);
+            if (length > self->str->length - start)
+                length = self->str->length - start;
+            struct byte_array *str = byte_array_slice(self->str, start, length);
             result = variable_new_str(context, str);
             byte_array_del(str);
             break;
@@ -586,6 +915,8 @@ struct variable *variable_part(struct context *context,
             uint32_t len = self->list.ordered->length;
             if ((0 == len) || (start > len))
                 return variable_new_list(context, NULL);
+            if (length > len - start)
+                length = len - start;
             struct array *list = array_part(self->list.ordered, start, length);
             result = variable_new_list(context, list);
             array_del(list);
@@ -604,8 +935,10 @@ void variable_remove(struct variable *self, uint32_t start, int32_t length) {
         case VAR_NIL:
             break;
         case VAR_STR:
-            if (self->str->length > 0)
+            if (self->str->length > 0) {
+                self->str = byte_array_own(self->str);
                 byte_array_remove(self->str, start, length);
+            }
             break;
         case VAR_LST:
             if (self->list.ordered->length > 0)
@@ -618,6 +951,8 @@ void variable_remove(struct variable *self, uint32_t start, int32_t length) {
 
 struct variable *variable_concatenate(struct context *context, int n, const struct variable* v, ...) {
     struct variable* result = variable_copy(context, v);
+    if (result->type == VAR_STR)
+        result->str = byte_array_own(result->str);
 
     va_list argp;
     for (va_start(argp, v); --n;) {
@@ -650,21 +985,24 @@ static struct dic *variable_dic_insert2(struct context *context, struct dic* dic
         dic_insert(dic, key, val);
     }
 
-    key->gc_state = val->gc_state = GC_OLD;
+    variable_old(key);
+    variable_old(val);
     return dic;
 }
 
 struct variable *variable_copy_value(struct context *context, struct variable *value) {
     enum VarType vt = value->type;
     bool is_a_pointer = !(vt==VAR_INT || vt==VAR_FLT || vt==VAR_BOOL || vt==VAR_NIL);
-    return is_a_pointer ? value : variable_copy(context, value);
+    return is_a_pointer ? variable_own(context, value) : variable_copy(context, value);
 }
 
 void variable_dic_insert(struct context *context, struct variable* v,
                          struct variable *key, struct variable *datum) {
     if (key->type == VAR_NIL) {
         return;
-    } else if (v->type == VAR_LST || v->type == VAR_SRC) {
+    }
+    variable_barrier(context, v);
+    if (v->type == VAR_LST || v->type == VAR_SRC) {
         v->list.dic = variable_dic_insert2(context, v->list.dic, key, datum);
     } else if (v->type == VAR_FNC) {
         v->fnc.closure = variable_dic_insert2(context, v->list.dic, key, datum);
@@ -689,21 +1027,17 @@ static bool variable_compare_dics(struct context *context, const struct dic *udi
     if (NULL == udic) {
         return variable_compare_dics(context, vdic, udic);
     }
-    struct array *keys = dic_keys(udic);
-    bool result = true;
     if (NULL == vdic) {
-        result = !keys->length;
-    } else for (int i=0; i<keys->length; i++) {
-        struct variable *key = (struct variable*)array_get(keys, i);
-        struct variable *uvalue = (struct variable*)dic_get(udic, key);
+        return !udic->count;
+    }
+    struct variable *key, *uvalue;
+    for (uint32_t i=0; dic_next(udic, &i, (void**)&key, (void**)&uvalue);) {
         struct variable *vvalue = (struct variable*)dic_get(vdic, key);
         if (!variable_compare(context, uvalue, vvalue)) {
-            result = false;
-            break;
+            return false;
         }
     }
-    array_del(keys);
-    return result;
+    return true;
 }
 
 float variable_value_flt(const struct variable *v) {
@@ -772,11 +1106,12 @@ struct variable* variable_set(struct context *context,
         case VAR_INT:   dst->integer = src->integer;                        break;
         case VAR_FLT:   dst->floater = src->floater;                        break;
         case VAR_FNC:
-            dst->fnc.body = byte_array_copy(src->fnc.body);
+            dst->fnc.body = byte_array_share(src->fnc.body);
             dst->fnc.closure = dic_copy(context, src->fnc.closure);
+            dst->fnc.code = code_retain(src->fnc.code);
             break;
         case VAR_BYT:
-        case VAR_STR:   dst->str = byte_array_copy(src->str);               break;
+        case VAR_STR:   dst->str = byte_array_share(src->str);              break;
         case VAR_SRC:
         case VAR_LST:
             dst->list.ordered = array_copy(src->list.ordered);
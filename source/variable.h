@@ -17,6 +17,7 @@ enum VarType {
     VAR_BOOL,   // boolean
     VAR_VOID,   // void*
     VAR_CFNC,   // pointer to c function
+    VAR_WIN,    // marks a window of values atop the operand stack
     VAR_LAST,   // end of enums
 };    
 
@@ -25,6 +26,7 @@ enum Visited {      // for graph traversal
     VISITED_ONCE,   // we visited it once so far
     VISITED_MORE,   // we visited it more than once
     VISITED_REPEAT, // we've seen this before in the same structure
+    VISITED_NEVER,  // shared constant, which is never traversed or collected
     VISITED_LAST    // end of enums
 };
 
@@ -34,6 +36,19 @@ enum GCsafety { // for garbage collection
     GC_SAFE     // don't GC this variable just because
 };
 
+enum Generation {   // for generational garbage collection
+    GEN_YOUNG,      // in the nursery, since the last collection
+    GEN_OLD,        // survived a collection, so only a full one looks at it
+    GEN_REMEMBERED, // old, but given references since the last collection, which may be young
+    GEN_RELEASED    // a constant no code uses, which is collected like an old variable
+};
+
+enum Marking {      // what a collection marks
+    MARK_ALL,       // everything, all at once
+    MARK_YOUNG,     // only the nursery, all at once
+    MARK_OLD        // only the old generation, a step at a time
+};
+
 typedef struct context *context_p; // forward declaration
 typedef struct variable *(callback2func)(context_p context);
 
@@ -42,13 +57,15 @@ struct variable {
     enum Visited visited;
     uint32_t mark;
     enum GCsafety gc_state;
+    enum Generation generation;
+    uint32_t epoch;                 // of the last collection which marked it
 
     union {
         struct byte_array* str;
         struct {
-            
             struct byte_array* body;
             struct dic *closure;
+            struct code *code;      // decoded body, shared with its prototype, or else on first call
         } fnc;
         struct {
             struct array *ordered;
@@ -65,11 +82,15 @@ struct variable {
             struct variable*(*f)(context_p);
             struct variable *data;
         } cfnc;
+        struct {
+            uint32_t length, taken;     // values under a window's marker, and those assigned so far
+        } window;
     };
 };
 
 struct variable* variable_new(struct context *context, enum VarType type);
 void variable_del(struct context *context, struct variable *v);
+size_t variable_size(const struct variable *v);
 struct byte_array* variable_value(struct context *context, struct variable* v);
 const char *variable_value_str(struct context *context, struct variable *v);
 int32_t variable_value_int(const struct variable *v);
@@ -80,6 +101,11 @@ struct byte_array *variable_serialize(struct context *context, struct byte_array
 struct variable *variable_deserialize(struct context *context, struct byte_array *str);
 
 void variable_old(struct variable *v);
+void variable_immortals(void);
+bool variable_immortal(const struct variable *v);
+struct variable *variable_own(struct context *context, struct variable *v);
+struct variable *variable_new_constant(enum VarType type);
+void variable_release_constant(struct context *context, struct variable *v);
 
 struct variable* variable_new_bool(struct context *context, bool b);
 struct variable *variable_new_err(struct context *context, const char* message);
@@ -90,10 +116,14 @@ struct variable *variable_new_kvp(struct context *context, struct variable *key,
 struct variable *variable_new_float(struct context *context, float f);
 struct variable *variable_new_str(struct context *context, struct byte_array *str);
 struct variable *variable_new_str_chars(struct context *context, const char *str);
-struct variable *variable_new_fnc(struct context *context,
-                                  struct byte_array *body, struct variable *closures);
+struct variable *variable_new_fnc(struct context *context, struct byte_array *body,
+                                  struct code *code, struct variable *closures);
 struct variable *variable_new_list(struct context *context, struct array *list);
-struct variable *variable_new_src(struct context *context, uint32_t size);
+struct variable *variable_new_src(struct context *context, uint32_t size, struct variable *first);
+bool variable_new_window(struct context *context, uint32_t size);
+bool variable_window(const struct variable *v);
+struct variable *variable_window_next(struct context *context);
+void variable_window_drop(struct context *context);
 struct variable *variable_new_bytes(struct context *context, struct byte_array *bytes, uint32_t size);
 struct variable *variable_new_void(struct context *context, void *p);
 
@@ -112,6 +142,10 @@ bool variable_compare(struct context *context, const struct variable *u, const s
 struct variable *variable_copy_value(struct context *context, struct variable *value);
 void variable_mark(struct variable *v);
 void variable_unmark(struct variable *v);
+void variable_gc_mark(struct context *context, struct variable *v, enum Marking marking);
+void variable_gc_rescan(struct context *context, struct variable *v);
+bool variable_gc_step(struct context *context, uint32_t *budget);
+void variable_barrier(struct context *context, struct variable *v);
 
 const char *var_type_str(enum VarType vt);
 
@@ -17,16 +17,19 @@
 #include "variable.h"
 #include "sys.h"
 #include "node.h"
+#include "code.h"
+#include "slab.h"
 
-bool run(struct context *context, struct byte_array *program, struct dic *env, bool in_context);
-void display_code(struct context *context, struct byte_array *code);
+bool run(struct context *context, struct code *code, struct dic *env, bool in_context);
+void display_code(struct context *context, struct code *code);
 const char* indentation(struct context *context);
 static void dst(struct context *context);
+static struct variable *lookup_member(struct context *context, struct instruction *inst,
+                                      struct variable *indexable, struct variable *index);
 
 
 #ifdef DEBUG
 
-#define VM_DEBUGPRINT(...) DEBUGPRINT(__VA_ARGS__ ); if (!context->runtime) return;
 #define INDENT context->indent++;
 #define UNDENT context->indent--;
 
@@ -34,14 +37,27 @@ static void dst(struct context *context);
 
 #define INDENT
 #define UNDENT
-#define VM_DEBUGPRINT(...)
 
 #endif // not DEBUG
 
-#define VAR_MAX         99999
+#define HEAP_MIN        (8 << 20)   // least heap size for a full collection, in bytes
+#define NURSERY_MAX     (1 << 20)   // bytes allocated between collections
+#define HEAP_GROWTH     2.0f        // heap size for the next full collection, over live bytes
+#define GC_STEP         0           // references scanned per incremental step, or 0 for none
 #define GIL_SWITCH      100
+
+#if defined(__GNUC__) && !defined(VM_SWITCH)
+#define VM_THREADED     // dispatch with computed goto, instead of switch
+#define VM_DISPATCH     "threaded"
+#else
+#define VM_DISPATCH     "switch"
+#endif
+
 #define RETURN_IF_NOT_NULL(item) { if (item) { return item; } }
 
+// a variable name for lookups, on the C stack, since dics copy the keys they keep
+#define NAME_KEY(name) {.type = VAR_STR, .visited = VISITED_NEVER, .gc_state = GC_SAFE, .str = (name)}
+
 // assertions //////////////////////////////////////////////////////////////
 
 jmp_buf trying;
@@ -111,7 +127,12 @@ struct program_state *program_state_new(struct context *context, struct dic *env
     null_check(context);
     struct program_state *state = (struct program_state*)malloc(sizeof(struct program_state));
     state->named_variables = env ? dic_copy(context, env) : dic_new(context);
+    state->slots = NULL;
+    state->num_slots = 0;
+    state->slot_names = NULL;
     state->args = NULL;
+    state->code = NULL;
+    state->pc = 0;
     state->current_path = NULL;
     state->current_line = -1;
     stack_push(context->program_stack, state);
@@ -120,10 +141,23 @@ struct program_state *program_state_new(struct context *context, struct dic *env
     return state;
 }
 
+// room for the local variables of a function
+static void program_state_slots(struct program_state *state, struct code *code) {
+    if (!code->slots)
+        return;
+    state->slots = (struct variable**)calloc(code->slots, sizeof(struct variable*));
+    null_check(state->slots);
+    state->num_slots = code->slots;
+    state->slot_names = code->names;
+}
 
 void program_state_del(struct context *context, struct program_state *state) {
     //printf("\n>%" PRIu16 " - program_state_del %p from %p\n", current_thread_id(), state, context->program_stack);
     dic_del(state->named_variables);
+    free(state->slots);
+    if (NULL != state->current_path) {
+        byte_array_del(state->current_path);
+    }
     if (NULL != state->args) {
         state->args->gc_state = GC_OLD;
     }
@@ -137,14 +171,34 @@ struct context *context_new(struct context *parent, // parent context
     null_check(context);
 
     if (parent == NULL) { // I am the mother of all contexts
+        variable_immortals();
         struct context_shared *singleton = malloc(sizeof(struct context_shared));
         assert_message(!pthread_mutex_init(&singleton->gil, NULL), "gil init");
         assert_message(!pthread_cond_init(&singleton->thread_cond, NULL), "threads init");
-        singleton->all_variables = array_new();
+        singleton->tenured = array_new();
+        singleton->nursery = array_new();
+        singleton->remembered = array_new();
+        singleton->allocated = singleton->tenured_bytes = 0;
+        singleton->heap_max = singleton->heap_min = HEAP_MIN;
+        singleton->nursery_max = NURSERY_MAX;
+        singleton->growth = HEAP_GROWTH;
+        singleton->collect = false;
+        memset(&singleton->stats, 0, sizeof(struct gc_stats));
+        singleton->trace = NULL;
+        singleton->epoch = 0;
+        singleton->gray = stack_new();
+        singleton->pending = stack_new();
+        singleton->phase = PHASE_IDLE;
+        singleton->step = GC_STEP;
         singleton->callback = NULL;
         singleton->tick = 0;
         singleton->num_threads = 0;
         singleton->keepalive = false;
+        singleton->strings = singleton->constants = NULL;
+        singleton->constants_freed = 0;
+#ifdef VM_PROFILE
+        singleton->instructions = 0;
+#endif
         singleton->contexts = array_new();
         singleton->threads = array_new();
         context->singleton = singleton;
@@ -156,6 +210,7 @@ struct context *context_new(struct context *parent, // parent context
 
     context->program_stack = stack_new();
     context->operand_stack = stack_new();
+    context->pinned = array_new();
     context->runtime = runtime;
     context->error = NULL;
 #ifdef DEBUG
@@ -192,13 +247,20 @@ void context_del(struct context *context) {
             pthread_cond_destroy(&s->thread_cond);
             pthread_mutex_destroy(&s->gil);
 
-            struct array *vars = s->all_variables;
-            for (int i=0; i<vars->length; i++) {
-                struct variable *v = (struct variable *)array_get(vars, i);
-                variable_del(context, v);
+            // the nursery first, as constants its code releases go to the old generation
+            struct array *generations[] = {s->nursery, s->tenured};
+            for (int g=0; g<2; g++) {
+                struct array *vars = generations[g];
+                for (int i=0; i<vars->length; i++) {
+                    struct variable *v = (struct variable *)array_get(vars, i);
+                    variable_del(context, v);
+                }
+                array_del(vars);
             }
-            DEBUGPRINT("del all_variables %p\n", vars);
-            array_del(vars);
+            code_intern_del(context);
+            array_del(s->remembered);
+            stack_del(s->gray);
+            stack_del(s->pending);
         }
     }
 
@@ -213,102 +275,407 @@ void context_del(struct context *context) {
 
     stack_del(context->program_stack);
     stack_del(context->operand_stack);
+    array_del(context->pinned);
 
     free(context);
 }
 
 // garbage collection //////////////////////////////////////////////////////
 
-void unmark_all(struct context *context) {
-    struct array *vars = context->singleton->all_variables;
-    for (int i=0; i<vars->length; i++) {
-        struct variable *v = (struct variable*)array_get(vars, i);
-        variable_unmark(v);
-    }
-}
-
-void mark_dic(struct dic *dic, bool mark) {
-    if (NULL == dic) {
-        return;
-    }
-
-    struct array *a = dic_keys(dic);
-    struct array *b = dic_vals(dic);
-    for (int i=0; i<a->length; i++) {
-        struct variable *aiv = (struct variable*)array_get(a,i);
-        struct variable *biv = (struct variable*)array_get(b,i);
-        if (mark) {
-            variable_mark(aiv);
-            variable_mark(biv);
-        } else {
-            variable_unmark(aiv);
-            variable_unmark(biv);
-        }
-    }
-    array_del(a);
-    array_del(b);
-}
-
-void garbage_collect_mark_context(struct context *context) {
+void garbage_collect_mark_context(struct context *context, enum Marking marking) {
     // mark named variables
     struct program_state *state;
     for (int i=0; (state = (struct program_state*)stack_peek(context->program_stack, i)); i++) {
-        mark_dic(state->named_variables, true);
-        variable_mark(state->args);
+        struct variable *key, *value;
+        for (uint32_t j=0; dic_next(state->named_variables, &j, (void**)&key, (void**)&value);) {
+            variable_gc_mark(context, key, marking);
+            variable_gc_mark(context, value, marking);
+        }
+        for (int j=0; j<state->num_slots; j++)
+            variable_gc_mark(context, state->slots[j], marking);
+        variable_gc_mark(context, state->args, marking);
     }
 
     // mark variables in operand stack
     struct variable *v;
     for (int i=0; (v = (struct variable*)stack_peek(context->operand_stack, i)); i++) {
-        variable_mark(v);
+        variable_gc_mark(context, v, marking);
     }
+
+    // mark error being thrown
+    variable_gc_mark(context, context->error, marking);
 }
 
-void garbage_collect(struct context *context) {
-    null_check(context);
-    if (!context->runtime || context->singleton->all_variables->length < VAR_MAX) {
+// starts a collection: anything marked before is now unmarked
+static void garbage_collect_epoch(struct context_shared *singleton) {
+    if (++singleton->epoch)
         return;
-    }
-
-    DEBUGPRINT("\n>%" PRIu16 " - garbage collect %d vars exist", current_thread_id(), context->singleton->all_variables->length);
 
-    unmark_all(context);
+    // wrapped around, so clear old marks lest they match
+    singleton->epoch = 1;
+    struct array *generations[] = {singleton->tenured, singleton->nursery};
+    for (int g=0; g<2; g++)
+        for (int i=0; i<generations[g]->length; i++)
+            ((struct variable*)array_get(generations[g], i))->epoch = 0;
+}
 
-    // mark all
+static void garbage_collect_mark_roots(struct context *context, enum Marking marking) {
     struct array *contexts = context->singleton->contexts;
     for (int i=0; i<contexts->length; i++) {
         struct context *c = array_get(contexts, i);
-        garbage_collect_mark_context(c);
+        garbage_collect_mark_context(c, marking);
     }
 
     // mark system functions
-    variable_mark(context->singleton->sys);
+    variable_gc_mark(context, context->singleton->sys, marking);
 
     // mark C callback
-    variable_mark(context->singleton->callback);
+    variable_gc_mark(context, context->singleton->callback, marking);
+}
 
-    // mark vars used by protected vars
-    struct array *vars = context->singleton->all_variables;
+// empty the nursery into the old generation, which then has no references to young variables
+static void garbage_collect_promote(struct context_shared *singleton) {
+    struct array *nursery = singleton->nursery;
+    for (int i=0; i<nursery->length; i++) {
+        struct variable *v = (struct variable*)array_get(nursery, i);
+        v->generation = GEN_OLD;
+        array_add(singleton->tenured, v);
+    }
+    nursery->length = 0;
+
+    struct array *remembered = singleton->remembered;
+    for (int i=0; i<remembered->length; i++) {
+        struct variable *v = (struct variable*)array_get(remembered, i);
+        v->generation = GEN_OLD;
+    }
+    remembered->length = 0;
+}
+
+// frees unmarked variables and compacts the rest in one pass, returning the bytes they hold
+static size_t garbage_collect_sweep(struct context *context, struct array *vars) {
+    uint32_t epoch = context->singleton->epoch;
+    uint32_t survivors = 0;
+    size_t bytes = 0;
     for (int i=0; i<vars->length; i++) {
         struct variable *v = (struct variable*)array_get(vars, i);
+        if (v->epoch != epoch) {
+            variable_del(context, v);
+        } else {
+            vars->data[survivors++] = v;
+            bytes += variable_size(v);
+        }
+    }
+    vars->length = survivors;
+    return bytes;
+}
+
+// collects only the nursery, starting from the roots and the remembered set, and promotes what's left
+static void garbage_collect_minor(struct context *context) {
+    struct context_shared *singleton = context->singleton;
+    struct array *nursery = singleton->nursery;
+    DEBUGPRINT("\n>%" PRIu16 " - minor collect %d new vars", current_thread_id(), nursery->length);
+
+    // during an incremental collection, keep its epoch, so what's promoted stays marked
+    if (PHASE_IDLE == singleton->phase)
+        garbage_collect_epoch(singleton);
+    garbage_collect_mark_roots(context, MARK_YOUNG);
+
+    // mark vars used by protected vars
+    for (int i=0; i<nursery->length; i++) {
+        struct variable *v = (struct variable*)array_get(nursery, i);
         if (v->gc_state != GC_OLD)
-            variable_mark(v);
+            variable_gc_mark(context, v, MARK_YOUNG);
     }
-    
-    // sweep
+
+    // and by old vars which may refer to new ones
+    struct array *remembered = singleton->remembered;
+    for (int i=0; i<remembered->length; i++)
+        variable_gc_mark(context, (struct variable*)array_get(remembered, i), MARK_YOUNG);
+
+    singleton->tenured_bytes += garbage_collect_sweep(context, nursery);
+
+    // incremental marking hasn't seen what's promoted, nor what the remembered now refer to
+    if (PHASE_MARK == singleton->phase) {
+        for (int i=0; i<nursery->length; i++)
+            variable_gc_rescan(context, (struct variable*)array_get(nursery, i));
+        for (int i=0; i<remembered->length; i++)
+            variable_gc_rescan(context, (struct variable*)array_get(remembered, i));
+    }
+    garbage_collect_promote(singleton);
+}
+
+static void garbage_collect_full(struct context *context) {
+    struct context_shared *singleton = context->singleton;
+    garbage_collect_promote(singleton);
+
+    DEBUGPRINT("\n>%" PRIu16 " - garbage collect %d vars exist", current_thread_id(), singleton->tenured->length);
+#ifdef VM_PROFILE
+    uint32_t before = singleton->tenured->length;
+    struct timespec start, marked, swept;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
+
+    // mark all, abandoning any incremental collection
+    singleton->phase = PHASE_IDLE;
+    while (!stack_empty(singleton->pending))
+        stack_pop(singleton->pending);
+    garbage_collect_epoch(singleton);
+    garbage_collect_mark_roots(context, MARK_ALL);
+
+    // mark vars used by protected vars
+    struct array *vars = singleton->tenured;
     for (int i=0; i<vars->length; i++) {
         struct variable *v = (struct variable*)array_get(vars, i);
-        if (v->visited == VISITED_NOT) {
+        if (v->gc_state != GC_OLD)
+            variable_gc_mark(context, v, MARK_ALL);
+    }
+
+#ifdef VM_PROFILE
+    clock_gettime(CLOCK_MONOTONIC, &marked);
+#endif
+    singleton->tenured_bytes = garbage_collect_sweep(context, vars);
+#ifdef VM_PROFILE
+    clock_gettime(CLOCK_MONOTONIC, &swept);
+    printf("full collection of %u vars: mark %.3fms, sweep %.3fms\n",
+           before,
+           (marked.tv_sec - start.tv_sec) * 1e3 + (marked.tv_nsec - start.tv_nsec) / 1e6,
+           (swept.tv_sec - marked.tv_sec) * 1e3 + (swept.tv_nsec - marked.tv_nsec) / 1e6);
+#endif
+
+    // so a large live set isn't collected over and over
+    singleton->heap_max = MAX(singleton->heap_min, singleton->growth * singleton->tenured_bytes);
+    singleton->collect = false;
+}
+
+// incremental collection of the old generation //////////////////////////////
+//
+// Marking and sweeping run a step at a time, between statements, while minor
+// collections go on as usual, keeping the incremental collection's epoch. Old
+// variables given references meanwhile are in the remembered set, because of
+// the write barrier, and young ones are in the nursery, so at the end of
+// marking, the roots, nursery and remembered set are scanned again, all at once.
+
+// starts right after a minor collection, so the nursery is empty
+static void garbage_collect_start(struct context *context) {
+    struct context_shared *singleton = context->singleton;
+    DEBUGPRINT("\n>%" PRIu16 " - incremental collect %d vars", current_thread_id(), singleton->tenured->length);
+    garbage_collect_epoch(singleton);
+    singleton->phase = PHASE_MARK;
+    singleton->cursor = 0;
+    singleton->swept_bytes = 0;
+    garbage_collect_mark_roots(context, MARK_OLD);
+}
+
+static bool garbage_collect_mark_step(struct context *context, uint32_t *budget) {
+    struct context_shared *singleton = context->singleton;
+
+    // protected old vars are roots too, so look for them a few at a time
+    struct array *tenured = singleton->tenured;
+    for (; *budget && (singleton->cursor < tenured->length); (*budget)--) {
+        struct variable *v = (struct variable*)array_get(tenured, singleton->cursor++);
+        if (v->gc_state != GC_OLD)
+            variable_gc_mark(context, v, MARK_OLD);
+    }
+    return (singleton->cursor == tenured->length) && variable_gc_step(context, budget);
+}
+
+// finishes marking, all at once, by scanning whatever may have changed
+static void garbage_collect_remark(struct context *context) {
+    struct context_shared *singleton = context->singleton;
+    garbage_collect_mark_roots(context, MARK_OLD);
+
+    struct array *nursery = singleton->nursery;
+    for (int i=0; i<nursery->length; i++)
+        variable_gc_rescan(context, (struct variable*)array_get(nursery, i));
+    struct array *remembered = singleton->remembered;
+    for (int i=0; i<remembered->length; i++)
+        variable_gc_rescan(context, (struct variable*)array_get(remembered, i));
+
+    uint32_t unlimited = UINT32_MAX;
+    while (!variable_gc_step(context, &unlimited))
+        unlimited = UINT32_MAX;
+
+    singleton->phase = PHASE_SWEEP;
+    singleton->cursor = 0;
+}
+
+// frees unmarked old vars, moving the last one into each one's place
+static bool garbage_collect_sweep_step(struct context *context, uint32_t *budget) {
+    struct context_shared *singleton = context->singleton;
+    struct array *tenured = singleton->tenured;
+    for (; *budget && (singleton->cursor < tenured->length); (*budget)--) {
+        struct variable *v = (struct variable*)array_get(tenured, singleton->cursor);
+        if (v->epoch != singleton->epoch) {
             variable_del(context, v);
-            array_remove(context->singleton->all_variables, i--, 1);
+            tenured->data[singleton->cursor] = tenured->data[--tenured->length];
+        } else {
+            singleton->swept_bytes += variable_size(v);
+            singleton->cursor++;
         }
     }
+    return singleton->cursor == tenured->length;
+}
+
+// does budget's worth of the incremental collection; true once it's done
+static bool garbage_collect_step(struct context *context, uint32_t budget) {
+    struct context_shared *singleton = context->singleton;
+    if (PHASE_MARK == singleton->phase) {
+        if (!garbage_collect_mark_step(context, &budget))
+            return false;
+        garbage_collect_remark(context);
+    }
+    if (!garbage_collect_sweep_step(context, &budget))
+        return false;
+
+    singleton->phase = PHASE_IDLE;
+    singleton->tenured_bytes = singleton->swept_bytes;
+    singleton->heap_max = MAX(singleton->heap_min, singleton->growth * singleton->tenured_bytes);
+    return true;
+}
+
+static double garbage_collect_since(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void garbage_collect_done(struct context *context, const struct timespec *start, bool full) {
+    struct context_shared *singleton = context->singleton;
+    struct gc_stats *stats = &singleton->stats;
+    double pause = garbage_collect_since(start);
+    stats->pause_total += pause;
+    stats->pause_max = MAX(stats->pause_max, pause);
+    stats->collections++;
+    stats->full_collections += full;
+    stats->vars_after = singleton->tenured->length;
+    stats->bytes_after = singleton->tenured_bytes;
+
+    if (NULL != singleton->trace)
+        singleton->trace(context, stats, full);
+}
+
+void garbage_collect(struct context *context) {
+    null_check(context);
+    if (!context->runtime) {
+        return;
+    }
+    struct context_shared *singleton = context->singleton;
+    struct gc_stats *stats = &singleton->stats;
+    struct timespec start;
+
+    if ((PHASE_IDLE != singleton->phase) && !singleton->collect) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        stats->steps++;
+        if (garbage_collect_step(context, singleton->step ? singleton->step : UINT32_MAX)) {
+            garbage_collect_done(context, &start, true);
+        } else {
+            double pause = garbage_collect_since(&start);
+            stats->pause_total += pause;
+            stats->pause_max = MAX(stats->pause_max, pause);
+        }
+    }
+    if (!singleton->collect && (singleton->allocated < singleton->nursery_max)) {
+        return;
+    }
+
+    stats->vars_before = singleton->tenured->length + singleton->nursery->length;
+    stats->bytes_before = singleton->tenured_bytes + singleton->allocated;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    bool heap_full = (stats->bytes_before >= singleton->heap_max);
+    bool full = singleton->collect || (heap_full && !singleton->step);
+    if (full) {
+        garbage_collect_full(context);
+    } else {
+        garbage_collect_minor(context);
+        if (heap_full && (PHASE_IDLE == singleton->phase))
+            garbage_collect_start(context);
+    }
+    singleton->allocated = 0;
+    garbage_collect_done(context, &start, full);
+}
+
+// the counters, plus a census of what's live now, or at least not yet collected
+void garbage_collect_stats(struct context *context, struct gc_stats *stats) {
+    struct context_shared *singleton = context->singleton;
+    *stats = singleton->stats;
+
+    struct array *generations[] = {singleton->tenured, singleton->nursery};
+    for (int g=0; g<2; g++) {
+        for (int i=0; i<generations[g]->length; i++) {
+            const struct variable *v = (const struct variable*)array_get(generations[g], i);
+            stats->vars[v->type]++;
+            switch (v->type) {
+                case VAR_STR:
+                case VAR_BYT:
+                case VAR_ERR:
+                    if (NULL != v->str)
+                        stats->string_bytes += v->str->size;
+                    break;
+                case VAR_FNC:
+                    if (NULL != v->fnc.body)
+                        stats->string_bytes += v->fnc.body->size;
+                    break;
+                case VAR_LST:
+                case VAR_SRC:
+                    stats->array_bytes += v->list.ordered->size * sizeof(void*);
+                    if (NULL != v->list.dic)
+                        stats->dic_bytes += v->list.dic->capacity * (sizeof(uint32_t) + sizeof(struct dic_entry));
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+static void garbage_collect_setting(struct context *context, struct variable *settings,
+                                    const char *name, struct variable *value) {
+    struct variable *key = variable_new_str_chars(context, name);
+    variable_dic_insert(context, settings, key, value);
+}
 
-    printf("\n>%" PRIu16 " - garbage collected: %d vars left",
-           current_thread_id(),
-           context->singleton->all_variables->length);
+static struct variable *garbage_collect_size(struct context *context, size_t bytes) {
+    return variable_new_int(context, (int32_t)MIN(bytes, INT32_MAX));
+}
+
+// applies the nursery, heap, growth and step given in tuning, if any, and returns the settings and sizes
+struct variable *garbage_collect_settings(struct context *context, struct variable *tuning) {
+    struct context_shared *singleton = context->singleton;
 
-    unmark_all(context);
+    if ((NULL != tuning) && (tuning->type == VAR_LST)) {
+        struct variable *nursery = variable_dic_get(context, tuning, variable_new_str_chars(context, "nursery"));
+        struct variable *heap = variable_dic_get(context, tuning, variable_new_str_chars(context, "heap"));
+        struct variable *growth = variable_dic_get(context, tuning, variable_new_str_chars(context, "growth"));
+        struct variable *step = variable_dic_get(context, tuning, variable_new_str_chars(context, "step"));
+        if (nursery->type == VAR_INT) {
+            vm_assert(context, nursery->integer > 0, "nursery must be positive");
+            singleton->nursery_max = nursery->integer;
+        }
+        if (heap->type == VAR_INT) {
+            vm_assert(context, heap->integer > 0, "heap must be positive");
+            singleton->heap_min = heap->integer;
+        }
+        if ((growth->type == VAR_INT) || (growth->type == VAR_FLT)) {
+            vm_assert(context, variable_value_flt(growth) >= 1, "growth must be at least 1");
+            singleton->growth = variable_value_flt(growth);
+        }
+        if (step->type == VAR_INT) {
+            vm_assert(context, step->integer >= 0, "step must not be negative");
+            singleton->step = step->integer;
+        }
+        singleton->heap_max = MAX(singleton->heap_min, singleton->growth * singleton->tenured_bytes);
+    }
+
+    struct variable *settings = variable_new_list(context, NULL);
+    garbage_collect_setting(context, settings, "nursery", garbage_collect_size(context, singleton->nursery_max));
+    garbage_collect_setting(context, settings, "heap", garbage_collect_size(context, singleton->heap_min));
+    garbage_collect_setting(context, settings, "growth", variable_new_float(context, singleton->growth));
+    garbage_collect_setting(context, settings, "step", variable_new_int(context, singleton->step));
+    garbage_collect_setting(context, settings, "next", garbage_collect_size(context, singleton->heap_max));
+    garbage_collect_setting(context, settings, "live", garbage_collect_size(context, singleton->tenured_bytes));
+    garbage_collect_setting(context, settings, "allocated", garbage_collect_size(context, singleton->allocated));
+    return settings;
 }
 
 // display /////////////////////////////////////////////////////////////////
@@ -321,6 +688,7 @@ const struct number_string opcodes[] = {
     {VM_BUL,    "BUL"},
     {VM_FLT,    "FLT"},
     {VM_STR,    "STR"},
+    {VM_SET,    "SET"},
     {VM_VAR,    "VAR"},
     {VM_FNC,    "FNC"},
     {VM_SRC,    "SRC"},
@@ -335,6 +703,12 @@ const struct number_string opcodes[] = {
     {VM_DIV,    "DIV"},
     {VM_INC,    "INC"},
     {VM_MOD,    "MOD"},
+    {VM_BND,    "BND"},
+    {VM_BOR,    "BOR"},
+    {VM_INV,    "INV"},
+    {VM_XOR,    "XOR"},
+    {VM_LSF,    "LSF"},
+    {VM_RSF,    "RSF"},
     {VM_AND,    "AND"},
     {VM_ORR,    "ORR"},
     {VM_NOT,    "NOT"},
@@ -358,6 +732,9 @@ const struct number_string opcodes[] = {
     {VM_PTX,    "PTX"},
     {VM_FIL,    "FIL"},
     {VM_LIN,    "LIN"},
+    {VM_VRL,    "VRL"},
+    {VM_STL,    "STL"},
+    {VM_SXL,    "SXL"},
 };
 
 const char* indentation(struct context *context) {
@@ -370,13 +747,13 @@ const char* indentation(struct context *context) {
     return (const char*)str;
 }
 
-static void display_program_counter(struct context *context, const struct byte_array *program) {
+static void display_program_counter(struct context *context, uint32_t pc, enum Opcode op) {
     null_check(context);
     DEBUGSPRINT("%s>%" PRIu16 " - %3d:%3d ",
                 indentation(context),
                 current_thread_id(),
-                program->current - program->data,
-                *program->current);
+                pc,
+                op);
 }
 
 void display_program(struct byte_array *program) {
@@ -391,30 +768,90 @@ void display_program(struct byte_array *program) {
     UNDENT
 
     DEBUGPRINT("%sprogram instructions:\n", indentation(context));
-    byte_array_reset(program);
-    display_code(context, program);
+    struct code *code = code_new(context, program);
+    display_code(context, code);
+    code_del(context, code);
     context_del(context);
 
     UNDENT
     UNDENT
 }
 
-void display_code(struct context *context, struct byte_array *code) {
-    null_check(context);
-    bool was_running = context->runtime;
-    context->runtime = false;
+static void display_string(const char *format, const struct byte_array *string) {
+    char *str = byte_array_to_string(string);
+    DEBUGPRINT(format, str);
+    free(str);
+}
 
+static void display_block(struct context *context, const char *label, struct code *code) {
+    DEBUGPRINT("%s%s %d\n", indentation(context), label, code ? code->length : 0);
+    if (NULL != code)
+        display_code(context, code);
+}
+
+void display_code(struct context *context, struct code *code) {
+    null_check(context);
     INDENT
-    run(context, code, false, NULL);
+    for (uint32_t pc=0; pc<code->length; pc++) {
+        const struct instruction *inst = &code->instructions[pc];
+        DEBUGPRINT("%s%3d: %s", indentation(context), pc, NUM_TO_STRING(opcodes, inst->op));
+        switch (inst->op) {
+            case VM_INT:
+            case VM_BUL:
+            case VM_SRC:
+            case VM_LST:
+            case VM_CAL:
+            case VM_MET:
+            case VM_RET:
+            case VM_LIN:
+            case VM_JMP:
+            case VM_IFF:
+            case VM_AND:
+            case VM_ORR:    DEBUGPRINT(" %d\n", inst->number);                   break;
+            case VM_FLT:    DEBUGPRINT(" %f\n", inst->constant->floater);        break;
+            case VM_STR:    display_string(" %s\n", inst->constant->str);        break;
+            case VM_VAR:
+            case VM_SET:
+            case VM_STX:
+            case VM_FIL:    display_string(" %s\n", inst->string);               break;
+            case VM_VRL:
+            case VM_STL:
+            case VM_SXL:
+                DEBUGPRINT(" %d", inst->number);
+                display_string(" %s\n", inst->string);
+                break;
+            case VM_FNC: {
+                DEBUGPRINT(" %u,%u\n", inst->fnc.closures->length, inst->fnc.body->length);
+                INDENT
+                display_code(context, inst->fnc.code);
+                UNDENT
+            } break;
+            case VM_ITR:
+            case VM_COM:
+                display_string(" %s", inst->itr.who);
+                if (NULL != inst->itr.who2)
+                    display_string(",%s", inst->itr.who2);
+                DEBUGPRINT("\n");
+                if (NULL != inst->itr.where)
+                    display_block(context, "WHERE", inst->itr.where);
+                display_block(context, "DO", inst->itr.how);
+                break;
+            case VM_TRY:
+                DEBUGPRINT("\n");
+                display_block(context, "TRY", inst->trycatch.trial);
+                display_string("CATCH %s", inst->trycatch.name);
+                display_block(context, "", inst->trycatch.catcher);
+                break;
+            default:        DEBUGPRINT("\n");                                    break;
+        }
+    }
     UNDENT
-
-    context->runtime = was_running;
 }
 
 #else // not DEBUG
 
 const char* indentation(struct context *context) { return ""; }
-void display_code(struct context *context, struct byte_array *code) {}
+void display_code(struct context *context, struct code *code) {}
 
 #endif // DEBUG
 
@@ -432,12 +869,17 @@ void gil_unlock(struct context *context, const char *who) {
 
 // instruction implementations /////////////////////////////////////////////
 
-struct variable *src(struct context *context, enum Opcode op, struct byte_array *program) {
-    int32_t size = serial_decode_int(program);
+// self, if not NULL, goes first. Values assigned or returned stay on the stack as a window, if
+// they can, in which case this returns NULL; arguments are a list, which the callee keeps.
+struct variable *src(struct context *context,
+                     enum Opcode op,
+                     const struct instruction *inst,
+                     struct variable *self) {
+    int32_t size = inst->number;
     DEBUGSPRINT("%s %d", NUM_TO_STRING(opcodes, op), size);
-    if (!context->runtime)
+    if (((VM_SRC == op) || (VM_RET == op)) && variable_new_window(context, size))
         return NULL;
-    struct variable *v = variable_new_src(context, size);
+    struct variable *v = variable_new_src(context, size, self);
     variable_push(context,v);
     return v;
 }
@@ -450,29 +892,37 @@ void vm_call_src(struct context *context, struct variable *func) {
         state = program_state_new(context, NULL);
     struct variable *s = (struct variable*)stack_peek(context->operand_stack, 0);
 
-    if (func->type == VAR_CFNC && (NULL != func->cfnc.data))
+    if (func->type == VAR_CFNC && (NULL != func->cfnc.data)) {
+        variable_barrier(context, s);
         array_insert(s->list.ordered, 1, func->cfnc.data); // first argument
+    }
 
-    state->args = variable_copy(context, s);
+    struct variable *caller_args = state->args; // when a C function calls back
+    state->args = s; // read in place by the callee, and copied only for sys.args
     state->args->gc_state = GC_SAFE;
 
     INDENT
 
     // call the function
     switch (func->type) {
-        case VAR_FNC:
-            run(context, func->fnc.body, func->fnc.closure, false);
-            break;
+        case VAR_FNC: {
+            if (NULL == func->fnc.code) // decode on first call
+                func->fnc.code = code_new(context, func->fnc.body);
+            struct code *code = code_retain(func->fnc.code); // in case func is collected while running
+            run(context, code, func->fnc.closure, false);
+            code_del(context, code);
+        } break;
         case VAR_CFNC: {
             v = func->cfnc.f(context);
             if (v == NULL) {
-                v = variable_new_src(context, 0);
-            } else if (v->type != VAR_SRC) { // convert to VAR_SRC variable
-                variable_push(context,v);
-                v = variable_new_src(context, 1);
+                variable_new_window(context, 0);
+            } else if (v->type != VAR_SRC) { // a window of one value
+                variable_push(context, v);
+                if (!variable_new_window(context, 1))
+                    variable_push(context, variable_new_src(context, 1, NULL));
+            } else {
+                variable_push(context, v); // push the result
             }
-
-            variable_push(context,v); // push the result
         } break;
         case VAR_NIL:
             dst(context); // drop the params
@@ -483,7 +933,8 @@ void vm_call_src(struct context *context, struct variable *func) {
             break;
     }
 
-    state->args = NULL;
+    state->args->gc_state = GC_OLD;
+    state->args = caller_args;
 
     UNDENT
 }
@@ -498,8 +949,9 @@ void vm_call(struct context *context, struct variable *func, struct variable *ar
         if (s && s->type == VAR_SRC) {
             s = (struct variable*)stack_pop(context->operand_stack);
         } else {
-            s = variable_new_src(context, 0);
+            s = variable_new_src(context, 0, NULL);
         }
+        variable_barrier(context, s);
         for (; arg; arg = va_arg(argp, struct variable*)) {
             array_add(s->list.ordered, arg);
             variable_old(arg);
@@ -513,81 +965,71 @@ void vm_call(struct context *context, struct variable *func, struct variable *ar
 }
 
 static void func_call(struct context *context, enum Opcode op,
-               struct byte_array *program, struct variable *indexable) {
-    struct variable *func = context->runtime ? (struct variable*)variable_pop(context): NULL;
+               const struct instruction *inst, struct variable *indexable) {
+    struct variable *func = (struct variable*)variable_pop(context);
 
-    struct variable *s = src(context, op, program);
-    if (!context->runtime)
-        return;
-
-    if (indexable) {
-        array_insert(s->list.ordered, 0, indexable); // self
-    }
+    src(context, op, inst, indexable); // self, if a method
 
     vm_call_src(context, func);
 
     struct variable *result = (struct variable*)stack_peek(context->operand_stack, 0);
-    bool resulted = (result && (result->type == VAR_SRC));
+    bool resulted = (result && ((result->type == VAR_SRC) || variable_window(result)));
     
     if (!resulted) { // need a result for an expression, so pretend it returned nil
-        struct variable *v = variable_new_src(context, 0);
-        struct variable *nada = variable_new_nil(context);
-        array_add(v->list.ordered, nada);
-        variable_push(context, v);
+        variable_push(context, variable_new_nil(context));
+        variable_new_window(context, 1);
     }
 }
 
-static void method(struct context *context, struct byte_array *program) {
-    struct variable *indexable=NULL, *index;
-    if (context->runtime) {
-        indexable = variable_pop(context);
-        index = variable_pop(context);
-        struct variable *value = lookup(context, indexable, index);
-        variable_push(context, value);
-    }
-    func_call(context, VM_MET, program, indexable);
+static void method(struct context *context, struct instruction *inst) {
+    struct variable *indexable = variable_pop(context);
+    struct variable *index = variable_pop(context);
+    struct variable *value = lookup_member(context, inst, indexable, index);
+    variable_push(context, value);
+    func_call(context, VM_MET, inst, indexable);
 }
 
-static void source_file(struct context *context, struct byte_array *program) {
+static void source_file(struct context *context, const struct instruction *inst) {
+    DEBUGSPRINT("FIL %s", byte_array_to_string(inst->string));
     struct program_state *state = (struct program_state*)stack_peek(context->program_stack, 0);
-    state->current_path = serial_decode_string(program);
-    DEBUGSPRINT("FIL %s", byte_array_to_string(state->current_path));
+    if (NULL != state->current_path)
+        byte_array_del(state->current_path);
+    state->current_path = byte_array_share(inst->string); // the state may outlive the code
 }
                 
-static void source_line(struct context *context, struct byte_array *program) {
+static void source_line(struct context *context, const struct instruction *inst) {
+    DEBUGSPRINT("LIN %d", inst->number);
     struct program_state *state = (struct program_state*)stack_peek(context->program_stack, 0);
-    state->current_line = serial_decode_int(program);
-    DEBUGSPRINT("LIN %d", state->current_line);
+    state->current_line = inst->number;
 }
                 
-static void push_list(struct context *context, struct byte_array *program) {
-    int32_t num_items = serial_decode_int(program);
+static void push_list(struct context *context, const struct instruction *inst) {
+    int32_t num_items = inst->number;
     DEBUGSPRINT("LST %d", num_items);
-    if (!context->runtime) {
-        return;
-    }
 
     struct variable *list = variable_new_list(context, NULL);
-    while (num_items--) {
-        struct variable *v = variable_pop(context);
+    struct array *items = array_new_size(num_items); // popped last first
+    for (int32_t i=0; i<num_items; i++)
+        array_add(items, variable_pop(context));
+
+    for (int32_t i=num_items-1; i>=0; i--) { // in source order, which dics keep
+        struct variable *v = (struct variable*)array_get(items, i);
         enum VarType vt = v->type;
         if (vt == VAR_KVP) {
             variable_dic_insert(context, list, v->kvp.key, v->kvp.val);
         } else if (vt != VAR_NIL) {
-            array_insert(list->list.ordered, 0, v);
+            array_add(list->list.ordered, variable_own(context, v));
         }
     }
+    array_del(items);
 #ifdef DEBUG
     DEBUGSPRINT(": %s", variable_value_str(context, list));
 #endif
     variable_push(context, list);
 }
 
-static void push_kvp(struct context *context, struct byte_array *program) {
+static void push_kvp(struct context *context) {
     DEBUGSPRINT("KVP");
-    if (!context->runtime) {
-        return;
-    }
     struct variable *val = variable_pop(context);
     struct variable *key = variable_pop(context);
     key = variable_copy_value(context, key);
@@ -609,10 +1051,10 @@ struct variable *lookup_int(struct context *context,
     switch (indexable->type) {
         case VAR_STR:
         case VAR_BYT: {
-            char *str = (char*)malloc(2);
-            sprintf(str, "%c", indexable->str->data[index->integer]);
-            struct variable *str2 = variable_new_str_chars(context, str);
-            return str2;
+            struct byte_array *c = byte_array_slice(indexable->str, index->integer, 1);
+            struct variable *str = variable_new_str(context, c);
+            byte_array_del(c);
+            return str;
         } break;
         case VAR_LST:
             if (index->integer < indexable->list.ordered->length)
@@ -653,31 +1095,49 @@ struct variable *lookup(struct context *context,
     return variable_new_nil(context);
 }
 
-static void list_get(struct context *context) {
-    DEBUGSPRINT("GET");
-    if (!context->runtime) {
-        return;
+// lookup, for a literal string index, e.g. self.x, with inst's cache of whether it names a
+// built-in method, which then needn't be asked again, and where it was in the last list's dic
+static struct variable *lookup_member(struct context *context,
+                                      struct instruction *inst,
+                                      struct variable *indexable,
+                                      struct variable *index) {
+    if ((VAR_STR != index->type) || !variable_immortal(index))
+        return lookup(context, indexable, index);
+
+    uint32_t freed = context->singleton->constants_freed;
+    if ((inst->member.key != index) || (inst->member.freed != freed)) {
+        inst->member.key = index;
+        inst->member.freed = freed;
+        inst->member.other = false;
+        inst->member.entry = 0;
     }
+    if (!inst->member.other) {
+        RETURN_IF_NOT_NULL(builtin_method(context, indexable, index))
+        inst->member.other = true;
+    }
+
+    if (indexable->type == VAR_LST) {
+        RETURN_IF_NOT_NULL(dic_get_hinted(indexable->list.dic, index, &inst->member.entry))
+    }
+    if (indexable->type == VAR_FNC) {
+        RETURN_IF_NOT_NULL(dic_get_hinted(indexable->fnc.closure, index, &inst->member.entry))
+    }
+    return variable_new_nil(context);
+}
+
+static void list_get(struct context *context, struct instruction *inst) {
+    DEBUGSPRINT("GET");
     struct variable *indexable, *index;
     indexable = variable_pop(context);
     index = variable_pop(context);
-    struct variable *value = lookup(context, indexable, index);
+    struct variable *value = lookup_member(context, inst, indexable, index);
     variable_push(context, value);
 }
 
-static int32_t jump(struct context *context, struct byte_array *program) {
-    null_check(program);
-    uint8_t *start = program->current;
-    int32_t offset = serial_decode_int(program);
-    DEBUGSPRINT("JMP %d", offset);
-    if (!context->runtime) {
-        return 0;
-    }
-
-    if (offset < 0) { // skip over current VM_JMP instruction when going backward
-        offset -= (program->current - start) + 1;
-    }
-    return offset;// - (program->current - start);
+// returns the index of the next instruction to run
+static uint32_t jump(struct context *context, const struct instruction *inst) {
+    DEBUGSPRINT("JMP %d", inst->number);
+    return inst->number;
 }
 
 bool test_operand(struct context *context) {
@@ -693,51 +1153,42 @@ bool test_operand(struct context *context) {
     return indeed;
 }
 
-static int32_t iff(struct context *context, struct byte_array *program) {
-    null_check(program);
-    int32_t offset = serial_decode_int(program);
-    DEBUGSPRINT("IF %d", offset);
-    if (!context->runtime)
-        return 0;
-    return test_operand(context) ? 0 : offset;
+static uint32_t iff(struct context *context, const struct instruction *inst, uint32_t next) {
+    DEBUGSPRINT("IF %d", inst->number);
+    return test_operand(context) ? next : inst->number;
 }
 
 static void push_nil(struct context *context) {
     struct variable* var = variable_new_nil(context);
     DEBUGSPRINT("NIL", context->pcbuf);
-    if (!context->runtime)
-        return;
     variable_push(context, var);
 }
 
-static void push_int(struct context *context, struct byte_array *program) {
-    null_check(program);
-    int32_t num = serial_decode_int(program);
+static void push_int(struct context *context, const struct instruction *inst) {
+    int32_t num = inst->number;
     DEBUGSPRINT("INT %d", num);
-    if (!context->runtime)
-        return;
     struct variable* var = variable_new_int(context, num);
     variable_push(context, var);
 }
 
-static void push_bool(struct context *context, struct byte_array *program) {
-    null_check(program);
-    int32_t num = serial_decode_int(program);
+static void push_bool(struct context *context, const struct instruction *inst) {
+    int32_t num = inst->number;
     DEBUGSPRINT("BOOL %d", num);
-    if (!context->runtime)
-        return;
     struct variable* var = variable_new_bool(context, num);
     variable_push(context, var);
 }
 
-static void push_float(struct context *context, struct byte_array *program) {
-    null_check(program);
-    float num = serial_decode_float(program);
-    DEBUGSPRINT("FLT %f", num);
-    if (!context->runtime)
-        return;
-    struct variable* var = variable_new_float(context, num);
-    variable_push(context, var);
+static void push_float(struct context *context, const struct instruction *inst) {
+    DEBUGSPRINT("FLT %f", inst->constant->floater);
+    variable_push(context, inst->constant);
+}
+
+// slot of a local variable, by name, for code the compiler didn't resolve (e.g. sys.interpret)
+static int32_t find_slot(const struct program_state *state, const struct byte_array *name) {
+    for (int32_t i=0; i<state->num_slots; i++)
+        if ((NULL != state->slot_names[i]) && byte_array_equals(state->slot_names[i], name))
+            return i;
+    return -1;
 }
 
 struct variable *find_var(struct context *context, struct variable *key) {
@@ -746,8 +1197,14 @@ struct variable *find_var(struct context *context, struct variable *key) {
     const struct program_state *state = (const struct program_state*)stack_peek(context->program_stack, 0);
     if (NULL == state)
         return NULL;
+    struct variable *v = NULL;
+    int32_t slot = find_slot(state, key->str);
+    if (slot >= 0)
+        v = state->slots[slot];
+
     struct dic *var_dic = state->named_variables;
-    struct variable *v = (struct variable*)dic_get(var_dic, key);
+    if (NULL == v)
+        v = (struct variable*)dic_get(var_dic, key);
 
     if ((NULL == v) && !strncmp(RESERVED_SYS, (const char*)key->str->data, strlen(RESERVED_SYS)))
         v = context->singleton->sys;
@@ -755,68 +1212,66 @@ struct variable *find_var(struct context *context, struct variable *key) {
     if ((NULL == v) && context->singleton->callback)
         v = variable_dic_get(context, context->singleton->callback, key);
 
-    vm_assert(context, v, "\n>%" PRIu16 " - could not find %s ", //in state %p from program stack %p",
-              current_thread_id(), byte_array_to_string(key->str));//, state, context->program_stack);
+    if (NULL == v) { // the name is only made into a C string when it's needed
+        print_stack_trace(context);
+        vm_exit_message(context, "\n>%" PRIu16 " - could not find %s ", //in state %p from program stack %p",
+                        current_thread_id(), byte_array_to_string(key->str));//, state, context->program_stack);
+    }
 
     //DEBUGPRINT("\n>%" PRIu16 " - found %s in %p from %p", current_thread_id(), byte_array_to_string(key->str), state, context->program_stack);
 
     return v;
 }
 
-static void push_var(struct context *context, struct byte_array *program) {
-    struct byte_array* name = serial_decode_string(program);
+// a local variable from its slot, or else by name, e.g. from a closure
+static struct variable *get_variable(struct context *context,
+                                     struct program_state *state,
+                                     struct byte_array *name,
+                                     int32_t slot) {
+    if ((slot >= 0) && (NULL != state->slots[slot]))
+        return state->slots[slot];
+
+    struct variable key = NAME_KEY(name);
+    return find_var(context, &key);
+}
+
+static void push_var(struct context *context, struct program_state *state, const struct instruction *inst) {
+    struct byte_array* name = inst->string;
 #ifdef DEBUG
-        char *str = byte_array_to_string(name);
-        DEBUGSPRINT("VAR %s", str);
-        free(str);
-    if (!context->runtime)
-        return;
+    char *str = byte_array_to_string(name);
+    DEBUGSPRINT("%s %s", NUM_TO_STRING(opcodes, inst->op), str);
+    free(str);
 #endif // DEBUG
-    struct variable *key = variable_new_str(context, name);
-    struct variable *v = find_var(context, key);
+    struct variable *v = get_variable(context, state, name, inst->number);
     variable_push(context, v);
-    byte_array_del(name);
 }
 
-static void push_str(struct context *context, struct byte_array *program) {
-    struct byte_array* str = serial_decode_string(program);
+static void push_str(struct context *context, const struct instruction *inst) {
 #ifdef DEBUG
-    char *str2 = byte_array_to_string(str);
-    DEBUGSPRINT("STR %s", str2);
-    free(str2);
-    if (!context->runtime)
-        return;
+    char *str = byte_array_to_string(inst->constant->str);
+    DEBUGSPRINT("STR %s", str);
+    free(str);
 #endif // DEBUG
-    struct variable* v = variable_new_str(context, str);
-    byte_array_del(str);
-    variable_push(context, v);
+    variable_push(context, inst->constant);
 }
 
-static void push_fnc(struct context *context, struct byte_array *program) {
-    uint32_t num_closures = serial_decode_int(program);
-    struct variable *closures = NULL;
+static void push_fnc(struct context *context, struct program_state *state, const struct instruction *inst) {
+    uint32_t num_closures = inst->fnc.closures->length;
+    struct byte_array *body = inst->fnc.body;
+    DEBUGSPRINT("FNC %u,%u", num_closures, body->length);
 
+    struct variable *closures = NULL;
     for (int i=0; i<num_closures; i++) {
-        struct byte_array *name = serial_decode_string(program);
-        struct variable *key = variable_new_str(context, name);
-        byte_array_del(name);
-        if (context->runtime) {
-            if (closures == NULL)
-                closures = variable_new_list(context, NULL);
-            struct variable *c = find_var(context, key);
-            variable_dic_insert(context, closures, key, c);
-        }
+        struct byte_array *name = (struct byte_array*)array_get(inst->fnc.closures, i);
+        struct variable key = NAME_KEY(name);
+        if (closures == NULL)
+            closures = variable_new_list(context, NULL);
+        struct variable *c = get_variable(context, state, name, inst->fnc.slots[i]);
+        variable_dic_insert(context, closures, &key, c);
     }
 
-    struct byte_array *body = serial_decode_string(program);
-
-    DEBUGSPRINT("FNC %u,%u", num_closures, body->length);
-
-    if (context->runtime) {
-        struct variable *f = variable_new_fnc(context, body, closures);
-        variable_push(context, f);
-    }
-    byte_array_del(body);
+    struct variable *f = variable_new_fnc(context, body, inst->fnc.code, closures);
+    variable_push(context, f);
 }
 
 void set_named_variable(struct context *context,
@@ -826,26 +1281,47 @@ void set_named_variable(struct context *context,
     //DEBUGPRINT(" set_named_variable: %p\n", state);
     if (NULL == state)
         state = (struct program_state*)stack_peek(context->program_stack, 0);
-    struct dic *var_dic = state->named_variables;
-    struct variable *name2 = variable_new_str(context, name);
-    dic_insert(var_dic, name2, value);
+    int32_t slot = find_slot(state, name);
+    if (slot >= 0) { // a local, set by code the compiler didn't resolve
+        state->slots[slot] = value;
+        variable_old(value);
+        return;
+    }
 
-    variable_old(name2);
+    struct dic *var_dic = state->named_variables;
+    struct variable key = NAME_KEY(name);
+    dic_insert(var_dic, &key, value);
     variable_old(value);
 
     // DEBUGPRINT("SET %s to %s\n", byte_array_to_string(name), variable_value_str(context, value));
     // DEBUGPRINT(" SET %s at %p in {p:%p, s:%p, m:%p}\n", byte_array_to_string(name), to_var, context->program_stack, state, var_dic);
 }
 
+// set a local variable in its slot, or else by name
+static void set_variable(struct context *context,
+                         struct program_state *state,
+                         struct byte_array *name,
+                         int32_t slot,
+                         struct variable *value) {
+    if (slot < 0) {
+        set_named_variable(context, state, name, value);
+        return;
+    }
+    state->slots[slot] = value;
+    variable_old(value);
+}
+
 // pop variable off operand stack
 static struct variable *get_value(struct context *context, enum Opcode op) {
     struct variable *value = stack_peek(context->operand_stack, 0);
     if (NULL == value)
         return variable_new_nil(context);
 
-    bool interim = op == VM_STX || op == VM_PTX;
+    bool interim = op == VM_STX || op == VM_SXL || op == VM_PTX;
 
-    if (value->type == VAR_SRC) {
+    if (variable_window(value)) {
+        value = variable_window_next(context);
+    } else if (value->type == VAR_SRC) {
         struct array *values = value->list.ordered;
         struct dic *kvps = value->list.dic;
         bool listvar = values->length > values->current - values->data;
@@ -867,17 +1343,8 @@ static struct variable *get_value(struct context *context, enum Opcode op) {
 static void set(struct context *context,
                 enum Opcode op,
                 struct program_state *state,
-                struct byte_array *program) {
-    struct byte_array *name = serial_decode_string(program);    // destination variable name
-    if (!context->runtime) {
-#ifdef DEBUG
-        char *str = byte_array_to_string(name);
-        DEBUGSPRINT("%s %s", op==VM_SET?"SET":"STX", str);
-        free(str);
-        if (!context->runtime)
-            return;
-#endif // DEBUG
-    }
+                const struct instruction *inst) {
+    struct byte_array *name = inst->string;    // destination variable name
     struct variable *value = get_value(context, op);
 
 #ifdef DEBUG
@@ -885,35 +1352,34 @@ static void set(struct context *context,
     //printf("\nstr=%p\n", variable_value_str(context, value));
 
     DEBUGSPRINT("%s %s to %s",
-            op==VM_SET ? "SET" : "STX",
+            NUM_TO_STRING(opcodes, op),
             str,
             variable_value_str(context, value));
     free(str);
-    if (!context->runtime)
-        return;
 #endif // DEBUG
 
     assert_message(state && name && value, "value2");
 
     enum VarType vt = value->type;
-    if (vt==VAR_NIL || vt==VAR_INT || vt==VAR_BOOL)
+    if ((vt==VAR_NIL || vt==VAR_INT || vt==VAR_BOOL) && !variable_immortal(value))
+        value = variable_copy(context, value);
+    else if ((vt==VAR_STR) && variable_immortal(value)) // a literal, which may be changed in place
         value = variable_copy(context, value);
     
-    set_named_variable(context, state, name, value); // set the variable to the value
-    byte_array_del(name);
+    set_variable(context, state, name, inst->number, value); // set the variable to the value
 }
 
 static void dst(struct context *context) { // drop unused assignment right-hand-side values
-    DEBUGSPRINT("DST%s", !context->runtime ? " (not runtime)":"");
-    if (!context->runtime)
-        return;
+    DEBUGSPRINT("DST");
     if (stack_empty(context->operand_stack)) {
         DEBUGSPRINT(" %p empty", context->operand_stack);
         return;
     }
 
     struct variable *v = (struct variable*)stack_peek(context->operand_stack, 0);
-    if (v->type == VAR_SRC) { // unused result
+    if (variable_window(v)) { // unused values
+        variable_window_drop(context);
+    } else if (v->type == VAR_SRC) { // unused result
         stack_pop(context->operand_stack);
     } else {
         DEBUGSPRINT(" (%s)", var_type_str(v->type));
@@ -923,8 +1389,6 @@ static void dst(struct context *context) { // drop unused assignment right-hand-
 
 static void list_put(struct context *context, enum Opcode op) {
     DEBUGSPRINT("PUT");
-    if (!context->runtime)
-        return;
     struct variable* recipient = variable_pop(context);
     struct variable* key = variable_pop(context);
     struct variable *value = get_value(context, op);
@@ -934,10 +1398,13 @@ static void list_put(struct context *context, enum Opcode op) {
             switch (recipient->type) {
                 case VAR_LST:
                     value = variable_copy_value(context, value);
+                    variable_barrier(context, recipient);
                     array_set(recipient->list.ordered, key->integer, value);
                 break;
                 case VAR_STR:
                 case VAR_BYT:
+                    recipient = variable_own(context, recipient); // not a literal's constant
+                    recipient->str = byte_array_own(recipient->str);
                     byte_array_set(recipient->str, key->integer, value->integer);
                     break;
                 default:
@@ -1026,7 +1493,7 @@ static struct variable *binary_op_str(struct context *context,
 
     switch (op) {
         case VM_ADD: {
-            struct byte_array *wstr = byte_array_concatenate(2, ustr, vstr);
+            struct byte_array *wstr = byte_array_extend(ustr, vstr);
             w = variable_new_str(context, wstr);
             byte_array_del(wstr);
         } break;
@@ -1037,6 +1504,8 @@ static struct variable *binary_op_str(struct context *context,
             struct byte_array *nada = byte_array_from_string("");
             struct byte_array *wstr = byte_array_replace_all(ustr, vstr, nada);
             w = variable_new_str(context, wstr);
+            byte_array_del(wstr);
+            byte_array_del(nada);
         } break;
         default:
             w = (struct variable*)vm_exit_message(context, "unknown string operation");
@@ -1089,7 +1558,7 @@ static struct variable *binary_op_lst(struct context *context,
             } else if (vt == VAR_KVP) {
                 variable_dic_insert(context, w, v->kvp.key, v->kvp.val);
             } else if (vt != VAR_NIL) {
-                array_add(w->list.ordered, (void*)v);
+                array_add(w->list.ordered, (void*)variable_own(context, v));
             }
             break;
         case VM_SUB:
@@ -1147,13 +1616,11 @@ static struct variable *binary_op_nil(struct context *context,
     }
 }
 
-static int32_t boolean_op(struct context *context, struct byte_array *program, enum Opcode op) {
-    null_check(program);
-    int32_t short_circuit = serial_decode_int(program); // size of second operand, in program bytes
+static uint32_t boolean_op(struct context *context, const struct instruction *inst, uint32_t next) {
+    enum Opcode op = inst->op;
+    int32_t short_circuit = inst->number; // index of the instruction after the second operand
 
     DEBUGSPRINT("%s %d", NUM_TO_STRING(opcodes, op), short_circuit);
-    if (!context->runtime)
-        return 0;
     struct variable *v = variable_pop(context);
     null_check(v);
     bool tistrue;
@@ -1168,15 +1635,10 @@ static int32_t boolean_op(struct context *context, struct byte_array *program, e
         variable_push(context,v);
         return short_circuit; // jump over second operand if done
     }                         // otherwise, second operand is result
-    return 0;
+    return next;
 }
                 
 static void binary_op(struct context *context, enum Opcode op) {
-    if (!context->runtime) {
-        DEBUGSPRINT("%s", NUM_TO_STRING(opcodes, op));
-        return;
-    }
-
     struct variable *v = variable_pop(context);
     struct variable *u = variable_pop(context);
 
@@ -1219,15 +1681,11 @@ static void binary_op(struct context *context, enum Opcode op) {
 }
 
 static void unary_op(struct context *context, enum Opcode op) {
-    if (!context->runtime) {
-        DEBUGSPRINT("%s", NUM_TO_STRING(opcodes, op));
-        return;
-    }
-    
     struct variable *v = (struct variable*)variable_pop(context);
     struct variable *result = NULL;
 
     if (op == VM_INC) {
+        v = variable_own(context, v); // the variable gets the result, in case v is shared
         v->type = VAR_INT;
         result = v;
     }
@@ -1285,42 +1743,66 @@ static void unary_op(struct context *context, enum Opcode op) {
 #endif
 }
 
+// keeps what is iterated, and its dic from resizing, until the loop is done or an error unwinds it
+static inline void vm_pin(struct context *context, struct variable *what, struct dic *dic) {
+    array_add(context->pinned, what);
+    array_add(context->pinned, (void*)(intptr_t)what->gc_state);
+    array_add(context->pinned, dic);
+    if (!variable_immortal(what))
+        what->gc_state = GC_SAFE;
+    if (NULL != dic)
+        dic->iterators++;
+}
+
+void vm_unpin(struct context *context, uint32_t depth) {
+    struct array *pinned = context->pinned;
+    if (pinned->length <= depth)
+        return;
+    for (uint32_t i = pinned->length; i > depth; i -= 3) {
+        struct variable *what = (struct variable*)array_get(pinned, i-3);
+        enum GCsafety was = (enum GCsafety)(intptr_t)array_get(pinned, i-2);
+        struct dic *dic = (struct dic*)array_get(pinned, i-1);
+        if (NULL != dic)
+            dic->iterators--;
+        if (!variable_immortal(what))
+            what->gc_state = was;
+    }
+    array_remove(pinned, depth, -1);
+}
+
 // FOR who IN what WHERE where DO how
 static bool iterate(struct context *context,
-                    enum Opcode op,
                     struct program_state *state,
-                    struct byte_array *program) {
+                    const struct instruction *inst) {
     bool returned = false;
 
-    bool two = serial_decode_int(program);
-    struct byte_array *who = serial_decode_string(program);
-    struct byte_array *who2 = two ? serial_decode_string(program) : NULL;
-    struct byte_array *where = serial_decode_string(program);
-    struct byte_array *how = serial_decode_string(program);
-
-    struct variable *what = variable_pop(context);
+    enum Opcode op = inst->op;
+    bool two = inst->number;
+    struct byte_array *who = inst->itr.who;
+    struct byte_array *who2 = inst->itr.who2;
+    struct code *where = inst->itr.where;
+    struct code *how = inst->itr.how;
 
 #ifdef DEBUG
     char *str = byte_array_to_string(who);
-    DEBUGSPRINT("%s %s",
-                context->pcbuf,
-                NUM_TO_STRING(opcodes, op),
-                str);
+    DEBUGSPRINT("%s %s", NUM_TO_STRING(opcodes, op), str);
     free(str);
     if (two) {
         str = byte_array_to_string(who2);
-        DEBUGPRINT(",%s", str);
+        DEBUGSPRINT(",%s", str);
         free(str);
     }
-    if (!context->runtime) {
-        if (where && where->length) {
-            DEBUGSPRINT("%s\tWHERE %d", indentation(context), where->length);
-        }
-        DEBUGSPRINT("%s\tDO %d", indentation(context), how->length);
-        goto done;
-    }
 #endif
 
+    struct variable *what = variable_pop(context);
+    struct dic *dic = NULL; // a dic is walked in place, over the entries it had when the loop started
+    if ((what->type == VAR_LST) && !what->list.ordered->length)
+        dic = what->list.dic;
+    uint32_t depth = context->pinned->length;
+    vm_pin(context, what, dic); // popped, so protect it while iterating
+    if (PHASE_MARK == context->singleton->phase) // the incremental collection may not see it otherwise
+        variable_gc_mark(context, what, MARK_OLD);
+
     bool comprehending = (op == VM_COM);
     struct variable *result = comprehending ? variable_new_list(context, NULL) : NULL;
 
@@ -1330,36 +1812,32 @@ static bool iterate(struct context *context,
     
     assert_message(what->type == VAR_LST, "iterating over non-list");
     struct array *list = what->list.ordered;
-
-    bool its_a_dic = (!list->length && what->list.dic);
-    struct array *vals = NULL;
-    if (its_a_dic) {
-        list = dic_keys(what->list.dic);
-        vals = dic_vals(what->list.dic);
-    }
     uint32_t len = list->length;
+    uint32_t cursor = 0, end = (NULL != dic) ? dic->used : 0;
 
     // run through list or dic
-    for (int i=0; i<len; i++) {
+    for (int i=0; (NULL != dic) || (i < len); i++) {
+
+        struct variable *that, *val = NULL;
+        if (NULL == dic) {
+            that = (struct variable*)array_get(list, i);
+        } else if (!dic_next(dic, &cursor, (void**)&that, (void**)&val) || (cursor > end)) {
+            break;
+        }
 
         INDENT;
-        struct variable *that = (struct variable*)array_get(list, i);
         if (NULL == that) { // in sparse array
             continue;
         }
-        set_named_variable(context, state, who, that);
+        set_variable(context, state, who, inst->itr.slot, that);
 
         if (two) { // for k,v in dic
-            if (its_a_dic) {
-                that = (struct variable*)array_get(vals, i);
-            } else {
-                that = variable_new_nil(context);
+            if (NULL == val) {
+                val = variable_new_nil(context);
             }
-            set_named_variable(context, state, who2, that);
+            set_variable(context, state, who2, inst->itr.slot2, val);
         }
         
-        byte_array_reset(where);
-        byte_array_reset(how);
         if (where && where->length) {
             run(context, where, NULL, true);
         }
@@ -1373,11 +1851,12 @@ static bool iterate(struct context *context,
             }
 
             if (comprehending) {
-                struct variable *item = (struct variable*)stack_pop(context->operand_stack);
+                struct variable *item = variable_pop(context);
                 if (item->type == VAR_KVP) {
-                    variable_dic_insert(context, result, item->kvp.key, item->kvp.val);
+                    variable_dic_insert(context, result, item->kvp.key, variable_own(context, item->kvp.val));
                 } else {
-                    array_add(result->list.ordered, item);
+                    variable_barrier(context, result); // may have been promoted while looping
+                    array_add(result->list.ordered, variable_own(context, item));
                 }
             }
             UNDENT;
@@ -1390,177 +1869,221 @@ done2:
         variable_push(context,result);
 
 done:
-    byte_array_del(who);
-    byte_array_del(where);
-    byte_array_del(how);
+    vm_unpin(context, depth);
     return returned;
 }
 
-static inline bool vm_trycatch(struct context *context, struct byte_array *program) {
+static inline bool vm_trycatch(struct context *context,
+                               struct program_state *state,
+                               const struct instruction *inst) {
     bool returned = false;
-    struct byte_array *trial = serial_decode_string(program);
+    struct code *trial = inst->trycatch.trial;
     DEBUGSPRINT("TRY %d\n", trial->length);
     //display_code(context, trial);
-    struct byte_array *name = serial_decode_string(program);
-    struct byte_array *catcher = serial_decode_string(program);
+    struct byte_array *name = inst->trycatch.name;
+    struct code *catcher = inst->trycatch.catcher;
 #ifdef DEBUG
     char *str = byte_array_to_string(name);
     DEBUGSPRINT("%sCATCH %s %d\n", indentation(context), str, catcher->length);
     free(str);
 #endif
     //display_code(context, catcher);
-    if (!context->runtime) {
-        goto done;
-    }
 
     run(context, trial, NULL, true);
     if (context->error) {
-        set_named_variable(context, NULL, name, context->error);
+        set_variable(context, state, name, inst->trycatch.slot, context->error);
         context->error = NULL;
         returned = run(context, catcher, NULL, true);
     }
-done:
-    byte_array_del(name);
-    byte_array_del(trial);
-    byte_array_del(catcher);
     return returned;
 }
 
-static inline bool ret(struct context *context, struct byte_array *program) {
-    src(context, VM_RET, program);
-    return context->runtime;
+static inline void ret(struct context *context, const struct instruction *inst) {
+    src(context, VM_RET, inst, NULL);
 }
 
 static inline bool tro(struct context *context) {
     DEBUGSPRINT("THROW");
-    if (!context->runtime) {
-        return false;
-    }
-    context->error = (struct variable*)stack_pop(context->operand_stack);
+    context->error = variable_pop(context);
     return true;
 }
 
 bool run(struct context *context,
-         struct byte_array *program0,
+         struct code *code,
          struct dic *env,
          bool in_state) {
     null_check(context);
-    null_check(program0);
-    struct byte_array *program = byte_array_copy(program0);
-    program->current = program->data;
+    null_check(code);
     struct program_state *state = NULL;
-    enum Opcode inst = VM_NIL;
+    enum Opcode op = VM_NIL;
 
-    if (context->runtime) {
-        if (in_state) {
-            if (state == NULL) {
-                state = (struct program_state*)stack_peek(context->program_stack, 0);
-            }
-            if (state == NULL) {
-                state = program_state_new(context, env);
-            }
-            env = state->named_variables; // use the caller's variable set in the new state
-        } else { // new state on program stack
+    if (in_state) {
+        state = (struct program_state*)stack_peek(context->program_stack, 0);
+        if (state == NULL) {
             state = program_state_new(context, env);
+            program_state_slots(state, code);
         }
-    }
-
-    while (program->current < program->data + program->length) {
-        if (context->singleton->tick++ > GIL_SWITCH) {
-            context->singleton->tick = 0;
-            gil_unlock(context, "run");
-            gil_lock(context, "run");
-        }
-
-        inst = (enum Opcode)*program->current;
+        env = state->named_variables; // use the caller's variable set in the new state
+    } else { // new state on program stack
+        state = program_state_new(context, env);
+        program_state_slots(state, code);
+    }
+
+    // the caller's place, when sharing its state
+    struct code *caller_code = state->code;
+    uint32_t caller_pc = state->pc;
+    state->code = code;
+    state->pc = 0;
+
+    struct instruction *inst;
+    uint32_t next;
+
+// before each instruction
+#define VM_FETCH                                                            \
+    if (state->pc >= code->length)                                          \
+        goto done;                                                          \
+    if (context->singleton->tick++ > GIL_SWITCH) {                          \
+        context->singleton->tick = 0;                                       \
+        gil_unlock(context, "run");                                         \
+        gil_lock(context, "run");                                           \
+    }                                                                       \
+    VM_COUNT                                                                \
+    inst = &code->instructions[state->pc];                                  \
+    op = inst->op;                                                          \
+    next = state->pc + 1;                                                   \
+    VM_TRACE
+
+// after each instruction
+#define VM_ADVANCE                                                          \
+    state->pc = next;                                                       \
+    DEBUGPRINT("%s\n", byte_array_to_string(context->pcbuf));
 
 #ifdef DEBUG
-        byte_array_reset(context->pcbuf);
-        context->pcbuf->length = 0;
-        display_program_counter(context, program);
+#define VM_TRACE                                                            \
+    byte_array_reset(context->pcbuf);                                       \
+    context->pcbuf->length = 0;                                             \
+    display_program_counter(context, state->pc, op);
+#else
+#define VM_TRACE
 #endif
-        program->current++; // increment past the instruction
-        int32_t pc_offset = 0;
 
-        switch (inst) {
-            case VM_COM:
-            case VM_ITR:    if (iterate(context, inst, state, program))     goto done;  break;
-            case VM_RET:    if (ret(context, program))                      goto done;  break;
-            case VM_TRO:    if (tro(context))                               goto done;  break;
-            case VM_TRY:    if (vm_trycatch(context, program)) inst=VM_RET; goto done;  break;
-            case VM_MUL:
-            case VM_EQU:
-            case VM_DIV:
-            case VM_ADD:
-            case VM_SUB:
-            case VM_NEQ:
-            case VM_GTN:
-            case VM_LTN:
-            case VM_GRQ:
-            case VM_LEQ:
-            case VM_BND:
-            case VM_BOR:
-            case VM_MOD:
-            case VM_XOR:
-            case VM_INV:
-            case VM_RSF:
-            case VM_LSF:    binary_op(context, inst);                       break;
-            case VM_ORR:
-            case VM_AND:    pc_offset = boolean_op(context, program, inst); break;
-            case VM_INC:
-            case VM_NEG:
-            case VM_NOT:    unary_op(context, inst);                        break;
-            case VM_SRC:    src(context, inst, program);                    break;
-            case VM_DST:    dst(context);                                   break;
-            case VM_STX:
-            case VM_SET:    set(context, inst, state, program);             break;
-            case VM_JMP:    pc_offset = jump(context, program);             break;
-            case VM_IFF:    pc_offset = iff(context, program);              break;
-            case VM_CAL:    func_call(context, inst, program, NULL);        break;
-            case VM_LST:    push_list(context, program);                    break;
-            case VM_KVP:    push_kvp(context, program);                     break;
-            case VM_NIL:    push_nil(context);                              break;
-            case VM_INT:    push_int(context, program);                     break;
-            case VM_FLT:    push_float(context, program);                   break;
-            case VM_BUL:    push_bool(context, program);                    break;
-            case VM_STR:    push_str(context, program);                     break;
-            case VM_VAR:    push_var(context, program);                     break;
-            case VM_FNC:    push_fnc(context, program);                     break;
-            case VM_GET:    list_get(context);                              break;
-            case VM_PTX:
-            case VM_PUT:    list_put(context, inst);                        break;
-            case VM_MET:    method(context, program);                       break;
-            case VM_FIL:    source_file(context, program);                  break;
-            case VM_LIN:    source_line(context, program);                  break;
+#ifdef VM_PROFILE
+#define VM_COUNT context->singleton->instructions++;
+#else
+#define VM_COUNT
+#endif
+
+#ifdef VM_THREADED
+
+#define VM_CASE(o)  o:
+#define VM_BREAK    VM_ADVANCE VM_FETCH goto *dispatch[op];
+#define VM_LABEL(o) [o] = &&o
+
+    static const void *dispatch[VM_LAST] = {
+        VM_LABEL(VM_NIL), VM_LABEL(VM_INT), VM_LABEL(VM_ADD), VM_LABEL(VM_SET),
+        VM_LABEL(VM_VAR), VM_LABEL(VM_FLT), VM_LABEL(VM_BUL), VM_LABEL(VM_STR),
+        VM_LABEL(VM_FNC), VM_LABEL(VM_DST), VM_LABEL(VM_SRC), VM_LABEL(VM_LST),
+        VM_LABEL(VM_KVP), VM_LABEL(VM_GET), VM_LABEL(VM_PUT), VM_LABEL(VM_SUB),
+        VM_LABEL(VM_MUL), VM_LABEL(VM_DIV), VM_LABEL(VM_INC), VM_LABEL(VM_MOD),
+        VM_LABEL(VM_BND), VM_LABEL(VM_BOR), VM_LABEL(VM_INV), VM_LABEL(VM_XOR),
+        VM_LABEL(VM_LSF), VM_LABEL(VM_RSF), VM_LABEL(VM_NEG), VM_LABEL(VM_NOT),
+        VM_LABEL(VM_EQU), VM_LABEL(VM_NEQ), VM_LABEL(VM_GTN), VM_LABEL(VM_LTN),
+        VM_LABEL(VM_GRQ), VM_LABEL(VM_LEQ), VM_LABEL(VM_AND), VM_LABEL(VM_ORR),
+        VM_LABEL(VM_IFF), VM_LABEL(VM_JMP), VM_LABEL(VM_CAL), VM_LABEL(VM_MET),
+        VM_LABEL(VM_RET), VM_LABEL(VM_ITR), VM_LABEL(VM_COM), VM_LABEL(VM_TRY),
+        VM_LABEL(VM_TRO), VM_LABEL(VM_STX), VM_LABEL(VM_PTX), VM_LABEL(VM_FIL),
+        VM_LABEL(VM_LIN), VM_LABEL(VM_VRL), VM_LABEL(VM_STL), VM_LABEL(VM_SXL),
+    };
+
+    VM_FETCH
+    goto *dispatch[op];
+    {
+
+#else // switch
+
+#define VM_CASE(o)  case o:
+#define VM_BREAK    break;
+
+    for (;;) {
+        VM_FETCH
+        switch (op) {
+
+#endif // VM_THREADED
+
+            VM_CASE(VM_COM)
+            VM_CASE(VM_ITR) if (iterate(context, state, inst))              goto done;  VM_BREAK
+            VM_CASE(VM_RET) ret(context, inst);                             goto done;
+            VM_CASE(VM_TRO) if (tro(context))                               goto done;  VM_BREAK
+            VM_CASE(VM_TRY) if (vm_trycatch(context, state, inst)) op=VM_RET; goto done;
+            VM_CASE(VM_MUL)
+            VM_CASE(VM_EQU)
+            VM_CASE(VM_DIV)
+            VM_CASE(VM_ADD)
+            VM_CASE(VM_SUB)
+            VM_CASE(VM_NEQ)
+            VM_CASE(VM_GTN)
+            VM_CASE(VM_LTN)
+            VM_CASE(VM_GRQ)
+            VM_CASE(VM_LEQ)
+            VM_CASE(VM_BND)
+            VM_CASE(VM_BOR)
+            VM_CASE(VM_MOD)
+            VM_CASE(VM_XOR)
+            VM_CASE(VM_INV)
+            VM_CASE(VM_RSF)
+            VM_CASE(VM_LSF) binary_op(context, op);                         VM_BREAK
+            VM_CASE(VM_ORR)
+            VM_CASE(VM_AND) next = boolean_op(context, inst, next);         VM_BREAK
+            VM_CASE(VM_INC)
+            VM_CASE(VM_NEG)
+            VM_CASE(VM_NOT) unary_op(context, op);                          VM_BREAK
+            VM_CASE(VM_SRC) src(context, op, inst, NULL);                   VM_BREAK
+            VM_CASE(VM_DST) dst(context);                                   VM_BREAK
+            VM_CASE(VM_SXL)
+            VM_CASE(VM_STL)
+            VM_CASE(VM_STX)
+            VM_CASE(VM_SET) set(context, op, state, inst);                  VM_BREAK
+            VM_CASE(VM_JMP) next = jump(context, inst);                     VM_BREAK
+            VM_CASE(VM_IFF) next = iff(context, inst, next);                VM_BREAK
+            VM_CASE(VM_CAL) func_call(context, op, inst, NULL);             VM_BREAK
+            VM_CASE(VM_LST) push_list(context, inst);                       VM_BREAK
+            VM_CASE(VM_KVP) push_kvp(context);                              VM_BREAK
+            VM_CASE(VM_NIL) push_nil(context);                              VM_BREAK
+            VM_CASE(VM_INT) push_int(context, inst);                        VM_BREAK
+            VM_CASE(VM_FLT) push_float(context, inst);                      VM_BREAK
+            VM_CASE(VM_BUL) push_bool(context, inst);                       VM_BREAK
+            VM_CASE(VM_STR) push_str(context, inst);                        VM_BREAK
+            VM_CASE(VM_VRL)
+            VM_CASE(VM_VAR) push_var(context, state, inst);                 VM_BREAK
+            VM_CASE(VM_FNC) push_fnc(context, state, inst);                 VM_BREAK
+            VM_CASE(VM_GET) list_get(context, inst);                        VM_BREAK
+            VM_CASE(VM_PTX)
+            VM_CASE(VM_PUT) list_put(context, op);                          VM_BREAK
+            VM_CASE(VM_MET) method(context, inst);                          VM_BREAK
+            VM_CASE(VM_FIL) source_file(context, inst);                     VM_BREAK
+            VM_CASE(VM_LIN) source_line(context, inst);                     VM_BREAK
+#ifndef VM_THREADED
             default:
                 vm_exit_message(context, ERROR_OPCODE);
                 break;
         }
-        program->current += pc_offset;
-        DEBUGPRINT("%s\n", byte_array_to_string(context->pcbuf));
-
-    } // while
-
-    byte_array_del(program);
-    program = NULL;
-
-    if (!context->runtime) {
-        return false;
+        VM_ADVANCE
+#endif
     }
+
 done:
+    state->code = caller_code;
+    state->pc = caller_pc;
     if (!in_state) {
         struct program_state *s = stack_pop(context->program_stack);
         //printf("\n>%" PRIu16 " - pop state %p from program stack %p\n", current_thread_id(), s, context->program_stack);
         assert_message(s == state, "state variable doesn't match");
         program_state_del(context, state);
-    } else if (inst != VM_RET) {
+    } else if (op != VM_RET) {
         dst(context);
     }
-    if (NULL != program) {
-        byte_array_del(program);
-    }
     garbage_collect(context);
-    return inst == VM_RET;
+    return op == VM_RET;
 }
 
 void execute_with(struct context *context, struct byte_array *program, bool in_state) {
@@ -1569,15 +2092,19 @@ void execute_with(struct context *context, struct byte_array *program, bool in_s
     }
 
     null_check(program);
-    program = byte_array_copy(program);
-    byte_array_reset(program);
+    struct code *code = code_new(context, program);
 
 #ifdef DEBUG
     context->indent = 1;
 #endif
+    jmp_buf outer; // e.g. of the program that called sys.interpret, for errors after this returns
+    memcpy(outer, trying, sizeof(jmp_buf));
+    uint32_t pinned = context->pinned->length;
     if (!setjmp(trying)) {
-        run(context, program, NULL, in_state);
+        run(context, code, NULL, in_state);
     }
+    memcpy(trying, outer, sizeof(jmp_buf));
+    vm_unpin(context, pinned); // of loops an error jumped out of
 
     if (context->error) {
         DEBUGPRINT("error: %s\n", context->error->str->data);
@@ -1589,13 +2116,45 @@ void execute_with(struct context *context, struct byte_array *program, bool in_s
         DEBUGPRINT("warning: operand stack not empty: %s\n", str);
     }
 #endif
+    code_del(context, code); // under the lock, as its prototypes may be shared with running callbacks
     gil_unlock(context, "execute");
-    byte_array_del(program);
 }
 
 void execute(struct byte_array *program) {
     struct context *context = context_new(NULL, true, true);
+#ifdef VM_PROFILE
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
     execute_with(context, program, false);
+#ifdef VM_PROFILE
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    uint64_t instructions = context->singleton->instructions;
+    printf("\n%s dispatch: %" PRIu64 " instructions in %.3fs, %.0f instructions/sec\n",
+           VM_DISPATCH, instructions, seconds, instructions / seconds);
+
+    const struct { const char *name; size_t size; } classes[] = {
+        {"variable", sizeof(struct variable)},
+        {"array", sizeof(struct array)},
+        {"byte_array", sizeof(struct byte_array)},
+        {"dic", sizeof(struct dic)},
+    };
+    for (int i=0; i<ARRAY_LEN(classes); i++) { // one line per class, naming all that share it
+        size_t size = slab_class_size(classes[i].size);
+        bool seen = false;
+        for (int j=0; j<i; j++)
+            seen |= slab_class_size(classes[j].size) == size;
+        if (seen)
+            continue;
+        for (int j=i; j<ARRAY_LEN(classes); j++)
+            if (slab_class_size(classes[j].size) == size)
+                printf("%s%s", j > i ? ", " : "", classes[j].name);
+        uint32_t live, available;
+        slab_stats(classes[i].size, &live, &available);
+        printf(" slab (%zuB): %u live, %u free\n", size, live, available);
+    }
+#endif
     context_del(context);
 
     pid_t pid;
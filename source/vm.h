@@ -8,9 +8,52 @@
 #include "util.h"
 #include "variable.h"
 
+// collector counters, and a census of the heap, filled in by garbage_collect_stats
+struct gc_stats {
+    uint32_t collections;               // minor and full
+    uint32_t full_collections;          // including incremental ones
+    uint32_t steps;                     // of incremental collections
+    double pause_total;                 // milliseconds, over all collections
+    double pause_max;
+    uint32_t vars_before, vars_after;   // variables at the start and end of the last collection
+    size_t bytes_before, bytes_after;   // and bytes
+    uint32_t vars[VAR_LAST];            // live variables of each type
+    size_t string_bytes;                // held by strings, byte arrays and function bodies
+    size_t array_bytes;                 // by lists
+    size_t dic_bytes;                   // by dics
+};
+
+// of an incremental collection of the old generation
+enum Phase {
+    PHASE_IDLE,                         // none under way
+    PHASE_MARK,                         // marking from the roots, a step at a time
+    PHASE_SWEEP                         // freeing what's unmarked, a step at a time
+};
+
+// called after each collection
+typedef void (gc_trace)(struct context *context, const struct gc_stats *stats, bool full);
+
 // shared among all contexts
 struct context_shared {
-    struct array *all_variables;        // list of all variables
+    struct array *tenured;              // old generation, variables which survived a collection
+    struct array *nursery;              // young generation, variables created since the last collection
+    struct array *remembered;           // old variables given references since the last collection
+    size_t allocated;                   // bytes allocated since the last collection, roughly
+    size_t tenured_bytes;               // old generation size, as of the last collection
+    size_t heap_max;                    // heap size at which to collect the old generation too
+    size_t nursery_max;                 // bytes to allocate between collections
+    size_t heap_min;                    // least heap_max
+    float growth;                       // heap_max over the bytes left by a full collection
+    bool collect;                       // for a full collection at the next chance
+    struct gc_stats stats;              // counters, not the census
+    gc_trace *trace;                    // or NULL
+    uint32_t epoch;                     // of the current collection, for marking
+    struct stack *gray;                 // marked variables, not yet scanned
+    struct stack *pending;              // and for the incremental collection
+    enum Phase phase;                   // of the incremental collection
+    uint32_t step;                      // work per incremental step, or 0 to collect all at once
+    uint32_t cursor;                    // into the old generation, for the incremental collection
+    size_t swept_bytes;                 // held by the variables it kept so far
     uint32_t tick;                      // VM clock tick
     pthread_mutex_t gil;                // global interpreter lock
     pthread_cond_t thread_cond;         // condition for thread death
@@ -20,6 +63,12 @@ struct context_shared {
     struct array *contexts;             // list of all contexts
     struct array *threads;              // list of socket handler threads
     bool keepalive;                     // to not delete context when UI is active
+    struct dic *strings;                // names and literals of decoded code, interned, with their uses
+    struct dic *constants;              // literal strings and floats as immortal variables, with their uses
+    uint32_t constants_freed;           // released constants collected, whose addresses may be reused
+#ifdef VM_PROFILE
+    uint64_t instructions;              // number of instructions run
+#endif
 };
 
 // thread context
@@ -28,6 +77,7 @@ struct context {
     struct stack *program_stack;        // call stack
     struct stack *operand_stack;        // operand stack
     struct byte_array *program;         // bytecode
+    struct array *pinned;               // iterations in progress, as what, its gc_state and dic
     struct context_shared *singleton;   // shared state
     bool runtime;                       // false when just displaying
 #ifdef DEBUG
@@ -40,7 +90,11 @@ struct context {
 struct program_state {
     struct variable *args;              // function arguments
     struct dic *named_variables;        // variables in scope
-    uint32_t pc;                        // program counter
+    struct variable **slots;            // local variables, resolved by the compiler
+    uint32_t num_slots;
+    struct byte_array **slot_names;     // for finding locals by name
+    struct code *code;                  // code being run
+    uint32_t pc;                        // program counter, index into code
     struct byte_array *current_path;
     int32_t current_line;               // for stack trace;
 };
@@ -95,6 +149,10 @@ enum Opcode {
     VM_PTX, // put in expression
     VM_FIL, // source file name
     VM_LIN, // source line number
+    VM_VRL, // push a local variable
+    VM_STL, // set a local variable
+    VM_SXL, // local assignment in expression
+    VM_LAST // end of enums
 };
 
 #define ERROR_OPCODE "unknown opcode"
@@ -108,10 +166,13 @@ struct context *context_new(struct context *parent,
                             bool sys_funcs);
 void context_del(struct context *context);
 void garbage_collect(struct context *context);
+struct variable *garbage_collect_settings(struct context *context, struct variable *tuning);
+void garbage_collect_stats(struct context *context, struct gc_stats *stats);
 void vm_call(struct context *context, struct variable *func, struct variable *arg,...);
 void *vm_exit_message(struct context *context, const char *format, ...);
 void vm_null_check(struct context *context, const void* p);
 void vm_assert(struct context *context, bool assertion, const char *format, ...);
+void vm_unpin(struct context *context, uint32_t depth);
 struct variable *lookup(struct context *context, struct variable *indexable, struct variable *index);
 void gil_lock(struct context *context, const char *who);
 void gil_unlock(struct context *context, const char *who);